@@ -0,0 +1,103 @@
+#include <gst/gst.h>
+#include <math.h>
+
+/**
+ * @brief Fractional bits of the fixed-point source coordinates.
+ */
+#define AFFINE_FRAC_BITS  (16)
+#define AFFINE_ONE        (1 << AFFINE_FRAC_BITS)
+
+/**
+ * @brief Rotated square region of a frame.
+ */
+typedef struct
+{
+  gfloat cx; /**< center in source pixels */
+  gfloat cy;
+  gfloat size; /**< side length in source pixels */
+  gfloat angle; /**< rotation in radians, from the frame x axis to the region x axis */
+} AffineRegion;
+
+/**
+ * @brief Bilinear blend of 4 samples with 8-bit weights.
+ */
+#define affine_blend(p00,p01,p10,p11,fx,fy) \
+    ((((p00) * (256 - (fx)) + (p01) * (fx)) * (256 - (fy)) \
+        + ((p10) * (256 - (fx)) + (p11) * (fx)) * (fy) + 32768) >> 16)
+
+/**
+ * @brief Bilinear sample of an RGB pixel near the frame border, outside pixels are black.
+ */
+static void
+affine_sample_border (const guint8 *src, gint width, gint height,
+    gint x0, gint y0, gint fx, gint fy, guint8 *out)
+{
+  const guint8 black[3] = { 0, 0, 0 };
+  const guint8 *p[4];
+  gint k, c;
+
+  for (k = 0; k < 4; k++) {
+    gint x = x0 + (k & 1);
+    gint y = y0 + (k >> 1);
+
+    p[k] = (x >= 0 && y >= 0 && x < width && y < height) ?
+        src + 3 * (y * width + x) : black;
+  }
+
+  for (c = 0; c < 3; c++)
+    out[c] = affine_blend (p[0][c], p[1][c], p[2][c], p[3][c], fx, fy);
+}
+
+/**
+ * @brief Warp a rotated square region of an RGB frame to an RGB tensor in one pass.
+ *
+ * Each output pixel is mapped back to the source with the inverse affine
+ * transform and sampled bilinearly. The source position is stepped in
+ * 16.16 fixed point, so the inner loop has no float math and no division.
+ */
+static void
+affine_warp_rgb (const guint8 *src, guint src_width, guint src_height,
+    const AffineRegion *region, guint8 *dst, guint dst_width, guint dst_height)
+{
+  gfloat c = cosf (region->angle);
+  gfloat s = sinf (region->angle);
+  gfloat step_u = region->size / dst_width;
+  gfloat step_v = region->size / dst_height;
+  gfloat lx = 0.5f * step_u - 0.5f * region->size;
+  gfloat ly = 0.5f * step_v - 0.5f * region->size;
+  /* source position of the first output pixel, in sample index space */
+  gint32 ox = lrintf ((region->cx + lx * c - ly * s - 0.5f) * AFFINE_ONE);
+  gint32 oy = lrintf ((region->cy + lx * s + ly * c - 0.5f) * AFFINE_ONE);
+  /* source step for one output column and one output row */
+  gint32 ux = lrintf (c * step_u * AFFINE_ONE);
+  gint32 uy = lrintf (s * step_u * AFFINE_ONE);
+  gint32 vx = lrintf (-s * step_v * AFFINE_ONE);
+  gint32 vy = lrintf (c * step_v * AFFINE_ONE);
+  gint width = src_width, height = src_height;
+  guint u, v;
+
+  for (v = 0; v < dst_height; v++) {
+    gint32 px = ox + (gint32) v * vx;
+    gint32 py = oy + (gint32) v * vy;
+    guint8 *out = dst + 3 * dst_width * v;
+
+    for (u = 0; u < dst_width; u++, px += ux, py += uy, out += 3) {
+      gint x0 = px >> AFFINE_FRAC_BITS;
+      gint y0 = py >> AFFINE_FRAC_BITS;
+      gint fx = (px >> (AFFINE_FRAC_BITS - 8)) & 0xff;
+      gint fy = (py >> (AFFINE_FRAC_BITS - 8)) & 0xff;
+      const guint8 *p00, *p10;
+
+      if (G_UNLIKELY (x0 < 0 || y0 < 0 || x0 >= width - 1 || y0 >= height - 1)) {
+        affine_sample_border (src, width, height, x0, y0, fx, fy, out);
+        continue;
+      }
+
+      p00 = src + 3 * (y0 * width + x0);
+      p10 = p00 + 3 * width;
+      out[0] = affine_blend (p00[0], p00[3], p10[0], p10[3], fx, fy);
+      out[1] = affine_blend (p00[1], p00[4], p10[1], p10[4], fx, fy);
+      out[2] = affine_blend (p00[2], p00[5], p10[2], p10[5], fx, fy);
+    }
+  }
+}
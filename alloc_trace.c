@@ -0,0 +1,274 @@
+#include <gst/gst.h>
+#include <stdio.h>
+
+/**
+ * @brief Allocation counters of an element.
+ *
+ * A memory is accounted to the first element whose src pad it leaves,
+ * and its free is accounted to the same element.
+ */
+typedef struct
+{
+  gchar *name; /**< element name */
+  guint64 allocs; /**< memories allocated */
+  guint64 frees; /**< memories freed */
+  guint64 alloc_bytes;
+  guint64 free_bytes;
+  guint64 peak_live_bytes;
+  guint64 last_alloc_bytes; /**< alloc_bytes at the last rate sample */
+  guint64 peak_rate; /**< max bytes allocated in one second */
+} AllocTraceStats;
+
+/**
+ * @brief Allocation tracer of a pipeline, shared with the memories it tagged.
+ */
+typedef struct
+{
+  GMutex lock; /**< lock for all the counters */
+  GPtrArray *stats; /**< AllocTraceStats of each element */
+  guint64 live_bytes; /**< bytes of the tagged memories not freed yet */
+  guint64 peak_live_bytes;
+  gint64 start_us;
+  gint64 end_us;
+  guint timer_id;
+} AllocTrace;
+
+/**
+ * @brief Tag of a memory, freed with it.
+ */
+typedef struct
+{
+  AllocTrace *trace; /**< strong reference */
+  AllocTraceStats *stats;
+  gsize bytes;
+} AllocTraceTag;
+
+#define ALLOC_TRACE_QUARK (alloc_trace_quark ())
+
+static GQuark
+alloc_trace_quark (void)
+{
+  static GQuark quark;
+
+  if (!quark)
+    quark = g_quark_from_static_string ("facemesh-alloc-trace");
+  return quark;
+}
+
+static void
+alloc_trace_stats_free (gpointer data)
+{
+  AllocTraceStats *stats = data;
+
+  g_free (stats->name);
+  g_free (stats);
+}
+
+static void
+alloc_trace_clear (AllocTrace *trace)
+{
+  g_ptr_array_unref (trace->stats);
+  g_mutex_clear (&trace->lock);
+}
+
+static void
+alloc_trace_unref (AllocTrace *trace)
+{
+  g_atomic_rc_box_release_full (trace, (GDestroyNotify) alloc_trace_clear);
+}
+
+/**
+ * @brief Destroy notify of the memory tag, accounts the free.
+ */
+static void
+alloc_trace_tag_free (gpointer data)
+{
+  AllocTraceTag *tag = data;
+  AllocTrace *trace = tag->trace;
+
+  g_mutex_lock (&trace->lock);
+  tag->stats->frees++;
+  tag->stats->free_bytes += tag->bytes;
+  trace->live_bytes -= tag->bytes;
+  g_mutex_unlock (&trace->lock);
+
+  alloc_trace_unref (trace);
+  g_slice_free (AllocTraceTag, tag);
+}
+
+/**
+ * @brief Pad probe on every src pad, tags the memories that were not seen before.
+ */
+static GstPadProbeReturn
+alloc_trace_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AllocTraceStats *stats = user_data;
+  AllocTrace *trace = g_object_get_data (G_OBJECT (pad), "alloc-trace");
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  guint i, n = gst_buffer_n_memory (buffer);
+
+  for (i = 0; i < n; i++) {
+    GstMemory *mem = gst_buffer_peek_memory (buffer, i);
+    AllocTraceTag *tag;
+    guint64 live;
+
+    if (gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (mem), ALLOC_TRACE_QUARK))
+      continue;
+
+    tag = g_slice_new (AllocTraceTag);
+    tag->trace = g_atomic_rc_box_acquire (trace);
+    tag->stats = stats;
+    /* shared sub-memories do not own their bytes */
+    tag->bytes = mem->parent ? 0 : mem->maxsize;
+    gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (mem), ALLOC_TRACE_QUARK, tag,
+        alloc_trace_tag_free);
+
+    g_mutex_lock (&trace->lock);
+    stats->allocs++;
+    stats->alloc_bytes += tag->bytes;
+    live = stats->alloc_bytes - stats->free_bytes;
+    stats->peak_live_bytes = MAX (stats->peak_live_bytes, live);
+    trace->live_bytes += tag->bytes;
+    trace->peak_live_bytes = MAX (trace->peak_live_bytes, trace->live_bytes);
+    g_mutex_unlock (&trace->lock);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Timer callback, samples the allocation rate of each element.
+ */
+static gboolean
+alloc_trace_rate_cb (gpointer user_data)
+{
+  AllocTrace *trace = user_data;
+  guint i;
+
+  g_mutex_lock (&trace->lock);
+  for (i = 0; i < trace->stats->len; i++) {
+    AllocTraceStats *stats = g_ptr_array_index (trace->stats, i);
+
+    stats->peak_rate = MAX (stats->peak_rate, stats->alloc_bytes - stats->last_alloc_bytes);
+    stats->last_alloc_bytes = stats->alloc_bytes;
+  }
+  g_mutex_unlock (&trace->lock);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Create an allocation tracer.
+ */
+static AllocTrace *
+alloc_trace_new (void)
+{
+  AllocTrace *trace = g_atomic_rc_box_new0 (AllocTrace);
+
+  g_mutex_init (&trace->lock);
+  trace->stats = g_ptr_array_new_with_free_func (alloc_trace_stats_free);
+  trace->start_us = g_get_monotonic_time ();
+
+  return trace;
+}
+
+/**
+ * @brief Probe the src pads of an element.
+ */
+static void
+alloc_trace_attach_element (AllocTrace *trace, GstElement *element)
+{
+  AllocTraceStats *stats;
+  GList *walk;
+
+  if (GST_IS_BIN (element))
+    return;
+
+  stats = g_new0 (AllocTraceStats, 1);
+  stats->name = gst_element_get_name (element);
+  g_ptr_array_add (trace->stats, stats);
+
+  GST_OBJECT_LOCK (element);
+  for (walk = element->srcpads; walk; walk = walk->next) {
+    GstPad *pad = walk->data;
+
+    g_object_set_data (G_OBJECT (pad), "alloc-trace", trace);
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, alloc_trace_probe_cb, stats, NULL);
+  }
+  GST_OBJECT_UNLOCK (element);
+}
+
+/**
+ * @brief Account the memories produced by every element of the pipeline.
+ *
+ * Request pads added later, like the ones of tee, are not probed, but a
+ * tee forwards the memories of its upstream element anyway.
+ *
+ * @param elements every element of the pipeline, collected before so that
+ *        no pad is probed twice
+ */
+static void
+alloc_trace_attach (AllocTrace *trace, GPtrArray *elements)
+{
+  guint i;
+
+  for (i = 0; i < elements->len; i++)
+    alloc_trace_attach_element (trace, g_ptr_array_index (elements, i));
+
+  trace->timer_id = g_timeout_add_seconds (1, alloc_trace_rate_cb, trace);
+}
+
+/**
+ * @brief Print the allocation table, elements which allocated nothing are skipped.
+ */
+static void
+alloc_trace_print (AllocTrace *trace)
+{
+  gdouble secs;
+  guint i;
+
+  if (!trace->end_us)
+    trace->end_us = g_get_monotonic_time ();
+  secs = MAX ((trace->end_us - trace->start_us) / 1000000.0, 1e-6);
+
+  g_mutex_lock (&trace->lock);
+  g_print ("%-24s %10s %10s %10s %12s %12s %12s %12s\n", "element", "allocs", "frees",
+      "bufs/s", "KB/s", "peak KB/s", "live KB", "peak KB");
+  for (i = 0; i < trace->stats->len; i++) {
+    AllocTraceStats *stats = g_ptr_array_index (trace->stats, i);
+
+    if (stats->allocs == 0)
+      continue;
+
+    g_print ("%-24s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %10.1f %12.1f %12.1f %12.1f %12.1f\n",
+        stats->name, stats->allocs, stats->frees, stats->allocs / secs,
+        stats->alloc_bytes / 1024.0 / secs, stats->peak_rate / 1024.0,
+        (stats->alloc_bytes - stats->free_bytes) / 1024.0, stats->peak_live_bytes / 1024.0);
+  }
+  g_print ("total live %.1f KB, peak live %.1f KB over %.1f s\n",
+      trace->live_bytes / 1024.0, trace->peak_live_bytes / 1024.0, secs);
+  g_mutex_unlock (&trace->lock);
+}
+
+/**
+ * @brief Stop sampling, called when the pipeline stops so that the rates cover the run only.
+ */
+static void
+alloc_trace_stop (AllocTrace *trace)
+{
+  if (trace->timer_id) {
+    g_source_remove (trace->timer_id);
+    trace->timer_id = 0;
+  }
+  trace->end_us = g_get_monotonic_time ();
+}
+
+/**
+ * @brief Release the tracer. Memories still alive keep it until they are freed.
+ */
+static void
+alloc_trace_free (AllocTrace *trace)
+{
+  alloc_trace_stop (trace);
+  alloc_trace_unref (trace);
+}
@@ -3,6 +3,18 @@
 
 #define BLAZEFACE_SHORT_RANGE_NUM_BOXS  (896)
 #define BLAZEFACE_NUM_COORD             (16)
+#define BLAZEFACE_NUM_KEYPOINTS         (6)
+#define BLAZEFACE_KEYPOINT_OFFSET       (4)
+
+/**
+ * @brief BlazeFace keypoint indices, from the subject's point of view.
+ */
+#define KEYPOINT_RIGHT_EYE   (0)
+#define KEYPOINT_LEFT_EYE    (1)
+#define KEYPOINT_NOSE_TIP    (2)
+#define KEYPOINT_MOUTH       (3)
+#define KEYPOINT_RIGHT_EAR   (4)
+#define KEYPOINT_LEFT_EAR    (5)
 
 /**
  * @brief Sigmoid function
@@ -10,10 +22,22 @@
 #define sigmoid(x) \
     (1.f / (1.f + expf (- ((float)x))))
 
+/**
+ * @brief Input tensor type of a tflite model.
+ */
+typedef enum
+{
+  MODEL_INPUT_FLOAT32 = 0, /**< float input normalized to [-1, 1] */
+  MODEL_INPUT_UINT8, /**< quantized input, raw uint8 pixels */
+  MODEL_INPUT_INT8, /**< quantized input, pixels shifted by -128 */
+  MODEL_INPUT_FLOAT16, /**< half precision input normalized to [-1, 1] */
+} ModelInputType;
+
 typedef struct
 {
   gchar *anchors_path;
   gchar *model_path;
+  ModelInputType input_type;
 
   guint num_boxes;
 #define ANCHOR_X_CENTER_IDX    (0)
@@ -31,6 +55,9 @@ typedef struct
   guint tensor_width;
   guint tensor_height;
 
+  /* region of the input frame the detector saw, boxes are decoded into it */
+  gint i_x;
+  gint i_y;
   guint i_width;
   guint i_height;
 
@@ -49,6 +76,7 @@ typedef struct
   int width;
   int height;
   gfloat prob;
+  gfloat keypoints[BLAZEFACE_NUM_KEYPOINTS][2]; /**< x, y in input pixels, not clamped */
 } detectedObject;
 
 /**
@@ -186,13 +214,13 @@ nms (GArray * results, gfloat threshold)
   }
 
   i = 0;
-  do {
+  while (i < results->len) {
     detectedObject *a = &g_array_index (results, detectedObject, i);
     if (a->valid == FALSE)
       g_array_remove_index (results, i);
     else
       i++;
-  } while (i < results->len);
+  }
 }
 
 gboolean
@@ -207,6 +235,7 @@ get_detected_object_i (int i, float* raw_boxes, float* raw_scores, BlazeFaceInfo
   float score = raw_scores[i];
   float ymin, xmin, ymax, xmax;
   int x, y, width, height;
+  int k;
 
   // decode boxes
   x_center = x_center / info->x_scale * info->anchors[i][ANCHOR_WIDTH_IDX] + info->anchors[i][ANCHOR_X_CENTER_IDX];
@@ -225,17 +254,31 @@ get_detected_object_i (int i, float* raw_boxes, float* raw_scores, BlazeFaceInfo
   score = score > 100.0 ? 100 : score;
   score = sigmoid(score);
 
-  x = xmin * info->i_width;
-  y = ymin * info->i_height;
+  x = xmin * info->i_width + info->i_x;
+  y = ymin * info->i_height + info->i_y;
   width = (xmax - xmin) * info->i_width;
   height = (ymax - ymin) * info->i_height;
-  object->x = MAX(0, x);
-  object->y = MAX(0, y);
-  object->width = MIN(width, info->i_width - object->x);
-  object->height = MIN(height, info->i_height - object->y);
+  object->x = MAX(info->i_x, x);
+  object->y = MAX(info->i_y, y);
+  object->width = MIN(width, info->i_x + (int) info->i_width - object->x);
+  object->height = MIN(height, info->i_y + (int) info->i_height - object->y);
   object->prob = score;
   object->valid = score >= 0.5f;
 
+  if (!object->valid)
+    return TRUE;
+
+  // decode keypoints, relative to the anchor like the box center
+  for (k = 0; k < BLAZEFACE_NUM_KEYPOINTS; k++) {
+    float kx = raw_boxes[box_offset + BLAZEFACE_KEYPOINT_OFFSET + 2 * k];
+    float ky = raw_boxes[box_offset + BLAZEFACE_KEYPOINT_OFFSET + 2 * k + 1];
+
+    kx = kx / info->x_scale * info->anchors[i][ANCHOR_WIDTH_IDX] + info->anchors[i][ANCHOR_X_CENTER_IDX];
+    ky = ky / info->y_scale * info->anchors[i][ANCHOR_HEIGHT_IDX] + info->anchors[i][ANCHOR_Y_CENTER_IDX];
+    object->keypoints[k][0] = kx * info->i_width + info->i_x;
+    object->keypoints[k][1] = ky * info->i_height + info->i_y;
+  }
+
   return TRUE;
 }
 
@@ -60,6 +60,8 @@
 #  include <config.h>
 #endif
 
+#include <math.h>
+#include <string.h>
 #include <gst/gst.h>
 #include <gst/video/video-format.h>
 #include <gst/video/gstvideoaggregator.h>
@@ -70,6 +72,7 @@
 #include <nnstreamer/nnstreamer_util.h>
 
 #include "gstcropscale.h"
+#include "hugepage_allocator.h"
 
 /**
  * @brief Internal data structure to describe tensor region.
@@ -80,6 +83,7 @@ typedef struct
   guint y;
   guint w;
   guint h;
+  gfloat angle; /**< rotation around the center in radians, 0 if not given */
 } tensor_crop_info_s;
 
 GST_DEBUG_CATEGORY_STATIC (gst_crop_scale_debug);
@@ -95,9 +99,15 @@ enum
 enum
 {
   PROP_0,
-  PROP_SILENT
+  PROP_SILENT,
+  PROP_LATENESS
 };
 
+/**
+ * @brief Default value of lateness, pairs raw and info in arrival order.
+ */
+#define DEFAULT_LATENESS (-1)
+
 /* the capabilities of the inputs and outputs.
  *
  * describe the real formats here.
@@ -123,8 +133,11 @@ static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
 #define gst_crop_scale_parent_class parent_class
 G_DEFINE_TYPE (GstCropScale, gst_crop_scale, GST_TYPE_ELEMENT);
 
-GST_ELEMENT_REGISTER_DEFINE (crop_scale, "crop_scale", GST_RANK_NONE,
-    GST_TYPE_CROP_SCALE);
+/* debug category for filtering log messages, initialized on registration
+ * so that it also works when the element is linked into the app */
+GST_ELEMENT_REGISTER_DEFINE_WITH_CODE (crop_scale, "crop_scale", GST_RANK_NONE,
+    GST_TYPE_CROP_SCALE,
+    GST_DEBUG_CATEGORY_INIT (gst_crop_scale_debug, "cropscale", 0, "Template cropscale"));
 
 static void gst_crop_scale_finalize (GObject *object);
 static void gst_crop_scale_set_property (GObject * object,
@@ -135,6 +148,8 @@ static GstStateChangeReturn gst_crop_scale_change_state (GstElement *element,
     GstStateChange transition);
 static gboolean gst_crop_scale_src_event (GstPad * pad,
     GstObject * parent, GstEvent * event);
+static gboolean gst_crop_scale_sink_query (GstCollectPads *pads,
+    GstCollectData *data, GstQuery *query, gpointer user_data);
 static gboolean gst_crop_scale_sink_event (GstCollectPads *pads,
     GstCollectData *data, GstEvent *event, gpointer user_data);
 static GstFlowReturn gst_crop_scale_collected (GstCollectPads *pads,
@@ -160,6 +175,12 @@ gst_crop_scale_class_init (GstCropScaleClass * klass)
       g_param_spec_boolean ("silent", "Silent", "Produce verbose output ?",
           FALSE, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_LATENESS,
+      g_param_spec_int ("lateness", "Lateness",
+          "The time difference between raw and info buffer in milliseconds "
+          "(-1 pairs buffers in arrival order)",
+          -1, G_MAXINT, DEFAULT_LATENESS, G_PARAM_READWRITE));
+
   gstelement_class->change_state =
     GST_DEBUG_FUNCPTR (gst_crop_scale_change_state);
 
@@ -205,6 +226,19 @@ gst_crop_scale_reset (GstCropScale * self)
     }
   }
 
+  if (self->pool) {
+    gst_buffer_pool_set_active (self->pool, FALSE);
+    gst_object_unref (self->pool);
+    self->pool = NULL;
+  }
+  self->pool_size = 0;
+
+  g_free (self->plan_x);
+  g_free (self->plan_y);
+  self->plan_x = NULL;
+  self->plan_y = NULL;
+  self->plan_crop_w = self->plan_crop_h = 0;
+
   self->send_stream_start = TRUE;
 }
 
@@ -227,6 +261,8 @@ gst_crop_scale_init (GstCropScale * self)
       GST_DEBUG_FUNCPTR (gst_crop_scale_collected), self);
   gst_collect_pads_set_event_function (self->collect,
       GST_DEBUG_FUNCPTR (gst_crop_scale_sink_event), self);
+  gst_collect_pads_set_query_function (self->collect,
+      GST_DEBUG_FUNCPTR (gst_crop_scale_sink_query), self);
 
   gst_collect_pads_add_pad (self->collect, self->sinkpad_raw,
       sizeof (GstCropScalePadData), NULL, TRUE);
@@ -239,6 +275,7 @@ gst_crop_scale_init (GstCropScale * self)
   gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
 
   self->silent = FALSE;
+  self->lateness = DEFAULT_LATENESS;
   self->send_stream_start = TRUE;
 }
 
@@ -272,6 +309,9 @@ gst_crop_scale_set_property (GObject * object, guint prop_id,
     case PROP_SILENT:
       filter->silent = g_value_get_boolean (value);
       break;
+    case PROP_LATENESS:
+      filter->lateness = g_value_get_int (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -288,6 +328,9 @@ gst_crop_scale_get_property (GObject * object, guint prop_id,
     case PROP_SILENT:
       g_value_set_boolean (value, filter->silent);
       break;
+    case PROP_LATENESS:
+      g_value_set_int (value, filter->lateness);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -399,6 +442,29 @@ gst_crop_scale_sink_event (GstCollectPads *pads, GstCollectData *data,
   return gst_collect_pads_event_default (pads, data, event, FALSE);
 }
 
+/**
+ * @brief Handle sink queries. Upstream is offered the huge page allocator for raw frames.
+ */
+static gboolean
+gst_crop_scale_sink_query (GstCollectPads *pads, GstCollectData *data,
+    GstQuery * query, gpointer user_data)
+{
+  GstCropScale *self = GST_CROP_SCALE (user_data);
+
+  if (GST_QUERY_TYPE (query) == GST_QUERY_ALLOCATION
+      && data->pad == self->sinkpad_raw) {
+    GstAllocator *allocator = hugepage_allocator_get ();
+    GstAllocationParams params;
+
+    hugepage_allocator_init_params (&params);
+    gst_query_add_allocation_param (query, allocator, &params);
+    gst_object_unref (allocator);
+    return TRUE;
+  }
+
+  return gst_collect_pads_query_default (pads, data, query, FALSE);
+}
+
 /**
  * @brief Set pad caps if not negotiated.
  */
@@ -495,7 +561,7 @@ gst_crop_scale_get_crop_info (GstCropScale * self, GstBuffer * info,
   GstMapInfo map;
   GstTensorMetaInfo meta;
   gsize hsize, dsize, esize;
-  guint i;
+  guint i, n;
   guint *pos;
   gboolean ret = FALSE;
 
@@ -533,11 +599,11 @@ gst_crop_scale_get_crop_info (GstCropScale * self, GstBuffer * info,
    * @todo Add various mode to crop tensor.
    * Now tensor-crop handles NHWC data format only.
    */
-  g_assert ((dsize % (esize * 4)) == 0);
-
   memset (cinfo, 0, sizeof (tensor_crop_info_s));
-  
-  g_assert (dsize / (esize * 4) == 1);
+
+  /* x, y, w, h and an optional rotation */
+  n = dsize / esize;
+  g_assert (n == 4 || n == 5);
   g_assert (meta.type == _NNS_UINT32);
 
   pos = (guint *)(map.data + hsize);
@@ -545,6 +611,8 @@ gst_crop_scale_get_crop_info (GstCropScale * self, GstBuffer * info,
   cinfo->y = pos[1];
   cinfo->w = pos[2];
   cinfo->h = pos[3];
+  if (n == 5)
+    cinfo->angle = (gint32) pos[4] / CROP_INFO_ANGLE_SCALE;
 
   ret = TRUE;
 
@@ -553,6 +621,138 @@ done:
   return ret;
 }
 
+/**
+ * @brief Internal function to get an output frame from the pool.
+ */
+static GstBuffer *
+gst_crop_scale_acquire_buffer (GstCropScale * self, gsize size)
+{
+  GstBuffer *buffer = NULL;
+
+  if (self->pool && self->pool_size != size) {
+    gst_buffer_pool_set_active (self->pool, FALSE);
+    gst_object_unref (self->pool);
+    self->pool = NULL;
+  }
+
+  if (!self->pool) {
+    GstStructure *config;
+    GstAllocator *allocator;
+    GstAllocationParams params;
+
+    self->pool = gst_buffer_pool_new ();
+    config = gst_buffer_pool_get_config (self->pool);
+    gst_buffer_pool_config_set_params (config, NULL, size, 2, 0);
+
+    allocator = hugepage_allocator_get ();
+    hugepage_allocator_init_params (&params);
+    gst_buffer_pool_config_set_allocator (config, allocator, &params);
+    gst_object_unref (allocator);
+
+    if (!gst_buffer_pool_set_config (self->pool, config)
+        || !gst_buffer_pool_set_active (self->pool, TRUE)) {
+      GST_ERROR_OBJECT (self, "Failed to activate the buffer pool.");
+      gst_object_unref (self->pool);
+      self->pool = NULL;
+      return NULL;
+    }
+    self->pool_size = size;
+  }
+
+  if (gst_buffer_pool_acquire_buffer (self->pool, &buffer, NULL) != GST_FLOW_OK) {
+    GST_ERROR_OBJECT (self, "Failed to acquire a buffer from the pool.");
+    return NULL;
+  }
+
+  return buffer;
+}
+
+/**
+ * @brief Internal function to compute the nearest-neighbor index tables.
+ *
+ * The tables only depend on the frame and crop size, so they are reused
+ * as long as the crop size does not change.
+ */
+static void
+gst_crop_scale_update_plan (GstCropScale * self, guint width, guint height,
+    guint crop_w, guint crop_h)
+{
+  guint i;
+
+  if (self->plan_x && self->plan_width == width && self->plan_height == height
+      && self->plan_crop_w == crop_w && self->plan_crop_h == crop_h)
+    return;
+
+  g_free (self->plan_x);
+  g_free (self->plan_y);
+  self->plan_x = g_new (guint, MAX (crop_w, 1));
+  self->plan_y = g_new (guint, MAX (crop_h, 1));
+
+  for (i = 0; i < crop_h; i++)
+    self->plan_y[i] = 4 * width * (guint) ((float) height / crop_h * i);
+  for (i = 0; i < crop_w; i++)
+    self->plan_x[i] = 4 * (guint) ((float) width / crop_w * i);
+
+  self->plan_width = width;
+  self->plan_height = height;
+  self->plan_crop_w = crop_w;
+  self->plan_crop_h = crop_h;
+  self->plan_rebuilds++;
+
+  GST_DEBUG_OBJECT (self, "Scale plan for %ux%u (%" G_GUINT64_FORMAT " rebuilds)",
+      crop_w, crop_h, self->plan_rebuilds);
+}
+
+/**
+ * @brief Internal function to put the overlay back into a rotated crop region.
+ *
+ * Each frame pixel covered by the region is mapped into the unrotated crop
+ * and takes the nearest overlay pixel, scaled from the crop to the frame size.
+ */
+static void
+gst_crop_scale_do_rotate (GstCropScale * self, const guint8 * inp,
+    guint8 * out, guint width, guint height, tensor_crop_info_s * cinfo)
+{
+  gfloat c = cosf (cinfo->angle);
+  gfloat s = sinf (cinfo->angle);
+  gfloat half = cinfo->w / 2.0f;
+  gfloat cx = cinfo->x + half;
+  gfloat cy = cinfo->y + cinfo->h / 2.0f;
+  gfloat extent = half * (fabsf (c) + fabsf (s));
+  gfloat scale_x = (gfloat) width / cinfo->w;
+  gfloat scale_y = (gfloat) height / cinfo->h;
+  gint x_begin, x_end, y_begin, y_end, x, y;
+
+  if (cinfo->w == 0 || cinfo->h == 0)
+    return;
+
+  /* bounding box of the rotated region, inside the frame */
+  x_begin = MAX ((gint) floorf (cx - extent), 0);
+  y_begin = MAX ((gint) floorf (cy - extent), 0);
+  x_end = MIN ((gint) ceilf (cx + extent), (gint) width);
+  y_end = MIN ((gint) ceilf (cy + extent), (gint) height);
+
+  for (y = y_begin; y < y_end; y++) {
+    gfloat dy = y + 0.5f - cy;
+    guint8 *row_out = out + 4 * (width * y + x_begin);
+
+    for (x = x_begin; x < x_end; x++, row_out += 4) {
+      gfloat dx = x + 0.5f - cx;
+      /* position in the unrotated crop */
+      gfloat qx = dx * c + dy * s + half;
+      gfloat qy = -dx * s + dy * c + cinfo->h / 2.0f;
+      gint sx, sy;
+
+      if (qx < 0 || qy < 0 || qx >= cinfo->w || qy >= cinfo->h)
+        continue;
+
+      sx = MIN ((gint) (qx * scale_x), (gint) width - 1);
+      sy = MIN ((gint) (qy * scale_y), (gint) height - 1);
+      memcpy (row_out, inp + 4 * (width * sy + sx), 4);
+    }
+  }
+}
+
 /**
  * @brief Internal function to crop incoming buffer.
  */
@@ -562,10 +762,10 @@ gst_crop_scale_do_scale (GstCropScale * self, GstBuffer * raw,
 {
   GstBuffer *result;
   GstMemory *mem;
-  GstMapInfo map;
-  guint i, j, w_inp, h_inp;
+  GstMapInfo map, out_map;
+  guint i, j, crop_w, crop_h;
   gsize size;
-  guint8 *scaled, *ptr, *inp, *row_ptr, *row_inp, *pix_inp;
+  guint8 *scaled, *ptr, *inp, *row_ptr, *row_inp;
   guint height, width;
 
   i = gst_buffer_n_memory (raw);
@@ -583,28 +783,49 @@ gst_crop_scale_do_scale (GstCropScale * self, GstBuffer * raw,
   size = 4 * width * height;
   g_assert (size == map.size);
 
-  result = gst_buffer_new ();
+  result = gst_crop_scale_acquire_buffer (self, size);
+  if (!result) {
+    gst_memory_unmap (mem, &map);
+    return NULL;
+  }
+
+  if (!gst_buffer_map (result, &out_map, GST_MAP_WRITE)) {
+    GST_ERROR_OBJECT (self, "Failed to map the output buffer.");
+    gst_buffer_unref (result);
+    gst_memory_unmap (mem, &map);
+    return NULL;
+  }
 
-  scaled = g_malloc0 (size);
+  scaled = out_map.data;
+  memset (scaled, 0, size);
+
+  if (cinfo->angle != 0.0f) {
+    gst_crop_scale_do_rotate (self, map.data, scaled, width, height, cinfo);
+    goto done;
+  }
+
+  /* keep the crop region inside the frame */
+  cinfo->x = MIN (cinfo->x, width);
+  cinfo->y = MIN (cinfo->y, height);
+  crop_w = MIN (cinfo->w, width - cinfo->x);
+  crop_h = MIN (cinfo->h, height - cinfo->y);
+  gst_crop_scale_update_plan (self, width, height, cinfo->w, cinfo->h);
 
   /* neareast-neighbor */
   ptr = scaled + 4 * width * cinfo->y + 4 * cinfo->x;
   inp = (guint8 *)map.data;
-  for (i = 0; i < cinfo->h; i++) {
-    h_inp = (int)((float)height / cinfo->h * i);
-    row_inp = inp + 4 * width * h_inp;
+  for (i = 0; i < crop_h; i++) {
+    row_inp = inp + self->plan_y[i];
     row_ptr = ptr;
-    for (j = 0; j < cinfo->w; j++) {
-      w_inp = (int)((float)width / cinfo->w * j);
-      pix_inp = row_inp + 4 * w_inp;
-      memcpy (row_ptr, pix_inp, 4);
+    for (j = 0; j < crop_w; j++) {
+      memcpy (row_ptr, row_inp + self->plan_x[j], 4);
       row_ptr += 4;
     }
     ptr += 4 * width;
   }
 
-  gst_buffer_append_memory (result, 
-        gst_memory_new_wrapped (0, scaled, size, 0, size, scaled, g_free));
+done:
+  gst_buffer_unmap (result, &out_map);
   gst_buffer_copy_into (result, raw, GST_BUFFER_COPY_METADATA, 0, -1);
 
   gst_memory_unmap (mem, &map);
@@ -639,6 +860,34 @@ gst_crop_scale_chain (GstCropScale * self,
     goto done;
   }
 
+  /**
+   * Upstream queues may drop buffers, so pair raw and info by timestamp.
+   * The older one is dropped and the newer one waits for its pair.
+   */
+  if (self->lateness >= 0) {
+    GstClockTime ts_raw = GST_BUFFER_PTS (buf_raw);
+    GstClockTime ts_info = GST_BUFFER_PTS (buf_info);
+    GstClockTime lateness = self->lateness * GST_MSECOND;
+
+    if (GST_CLOCK_TIME_IS_VALID (ts_raw) && GST_CLOCK_TIME_IS_VALID (ts_info)) {
+      if (ts_raw > ts_info + lateness) {
+        GST_DEBUG_OBJECT (self, "Drop old info buffer %" GST_TIME_FORMAT,
+            GST_TIME_ARGS (ts_info));
+        drop_raw = FALSE;
+        ret = GST_FLOW_OK;
+        goto done;
+      }
+
+      if (ts_info > ts_raw + lateness) {
+        GST_DEBUG_OBJECT (self, "Drop old raw buffer %" GST_TIME_FORMAT,
+            GST_TIME_ARGS (ts_raw));
+        drop_info = FALSE;
+        ret = GST_FLOW_OK;
+        goto done;
+      }
+    }
+  }
+
   cpad = (GstCropScalePadData *) data_raw;
   vinfo = &cpad->info;
 
@@ -651,6 +900,10 @@ gst_crop_scale_chain (GstCropScale * self,
   }
 
   result = gst_crop_scale_do_scale (self, buf_raw, vinfo, &cinfo);
+  if (!result) {
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
   ret = gst_pad_push (self->srcpad, result);
 
 done:
@@ -702,6 +955,11 @@ gst_crop_scale_collected (GstCollectPads * pads, gpointer user_data)
 }
 
 
+/* When CROPSCALE_STATIC is defined the element is linked into the app,
+ * which registers it with GST_ELEMENT_REGISTER (crop_scale, NULL).
+ */
+#ifndef CROPSCALE_STATIC
+
 /* entry point to initialize the plug-in
  * initialize the plug-in itself
  * register the element factories and other features
@@ -709,13 +967,6 @@ gst_crop_scale_collected (GstCollectPads * pads, gpointer user_data)
 static gboolean
 cropscale_init (GstPlugin * cropscale)
 {
-  /* debug category for filtering log messages
-   *
-   * exchange the string 'Template cropscale' with your description
-   */
-  GST_DEBUG_CATEGORY_INIT (gst_crop_scale_debug, "cropscale",
-      0, "Template cropscale");
-
   return GST_ELEMENT_REGISTER (crop_scale, cropscale);
 }
 
@@ -738,3 +989,5 @@ GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
     "crop_scale",
     cropscale_init,
     "0.0.1", "NONE", "CropScale", "NONE")
+
+#endif /* CROPSCALE_STATIC */
@@ -54,6 +54,12 @@
 
 G_BEGIN_DECLS
 
+/**
+ * @brief Scale of the optional 5th crop info element, the rotation of the
+ * crop region around its center in radians, stored as int32.
+ */
+#define CROP_INFO_ANGLE_SCALE (1000000.0)
+
 #define GST_TYPE_CROP_SCALE (gst_crop_scale_get_type())
 #define GST_CROP_SCALE(obj) \
   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_CROP_SCALE,GstCropScale))
@@ -81,10 +87,24 @@ struct _GstCropScale
   GstPad *srcpad;
 
   gboolean silent;
+  gint lateness; /**< max timestamp difference of raw and info in ms, -1 to pair in arrival order */
   gboolean send_stream_start;
   GstCollectPads *collect;
+
+  GstBufferPool *pool; /**< pool of output frames */
+  gsize pool_size; /**< size of the buffers in the pool */
+
+  guint plan_width; /**< frame size and crop size of the scale plan */
+  guint plan_height;
+  guint plan_crop_w;
+  guint plan_crop_h;
+  guint *plan_x; /**< source byte offset in a row, for each cropped column */
+  guint *plan_y; /**< source byte offset of the row, for each cropped row */
+  guint64 plan_rebuilds; /**< number of times the scale plan was computed */
 };
 
+GST_ELEMENT_REGISTER_DECLARE (crop_scale);
+
 G_END_DECLS
 
 #endif /* __GST_CROPSCALE_H__ */
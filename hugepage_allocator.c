@@ -0,0 +1,275 @@
+/**
+ * @file hugepage_allocator.c
+ * @brief GstAllocator for frame-sized buffers, backed by 2 MB huge pages.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* MAP_HUGETLB */
+#endif
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "hugepage_allocator.h"
+
+GST_DEBUG_CATEGORY_STATIC (hugepage_allocator_debug);
+#define GST_CAT_DEFAULT hugepage_allocator_debug
+
+#define HUGEPAGE_SIZE       (2 * 1024 * 1024)
+
+/**
+ * @brief Max number of freed mappings kept for reuse.
+ */
+#define HUGEPAGE_CACHE_MAX  (8)
+
+/**
+ * @brief Memory of the huge page allocator.
+ */
+typedef struct
+{
+  GstMemory mem;
+  gpointer data; /**< start of the mapping */
+  gsize map_size; /**< size of the mapping, 0 for shared sub-memories */
+} HugePageMemory;
+
+/**
+ * @brief A freed mapping waiting for reuse.
+ */
+typedef struct
+{
+  gpointer data;
+  gsize map_size;
+} HugePageBlock;
+
+typedef struct
+{
+  GstAllocator parent;
+
+  GMutex lock; /**< lock for cache */
+  GSList *cache; /**< freed HugePageBlock */
+  guint cache_len;
+  guint64 hugetlb_maps; /**< mappings backed by reserved huge pages */
+  guint64 fallback_maps; /**< regular mappings */
+} HugePageAllocator;
+
+typedef struct
+{
+  GstAllocatorClass parent_class;
+} HugePageAllocatorClass;
+
+GType hugepage_allocator_get_type (void);
+G_DEFINE_TYPE (HugePageAllocator, hugepage_allocator, GST_TYPE_ALLOCATOR);
+
+/**
+ * @brief Map a new block, with reserved huge pages if possible.
+ */
+static gpointer
+hugepage_map (HugePageAllocator *self, gsize map_size)
+{
+  gpointer data;
+
+  data = mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (data != MAP_FAILED) {
+    self->hugetlb_maps++;
+    return data;
+  }
+
+  /* no huge pages reserved, let the kernel back it with transparent huge pages */
+  data = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  madvise (data, map_size, MADV_HUGEPAGE);
+  self->fallback_maps++;
+  return data;
+}
+
+static GstMemory *
+hugepage_alloc (GstAllocator *allocator, gsize size, GstAllocationParams *params)
+{
+  HugePageAllocator *self = (HugePageAllocator *) allocator;
+  HugePageMemory *mem;
+  gsize total = size + params->prefix + params->padding;
+  gsize map_size = (total + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+  gpointer data = NULL;
+  GSList *walk;
+
+  g_mutex_lock (&self->lock);
+  for (walk = self->cache; walk; walk = walk->next) {
+    HugePageBlock *block = walk->data;
+
+    if (block->map_size == map_size) {
+      data = block->data;
+      self->cache = g_slist_delete_link (self->cache, walk);
+      self->cache_len--;
+      g_slice_free (HugePageBlock, block);
+      break;
+    }
+  }
+  if (!data)
+    data = hugepage_map (self, map_size);
+  g_mutex_unlock (&self->lock);
+
+  if (!data) {
+    GST_ERROR_OBJECT (self, "Failed to map %" G_GSIZE_FORMAT " bytes.", map_size);
+    return NULL;
+  }
+
+  mem = g_slice_new0 (HugePageMemory);
+  /* the mapping is page aligned, which covers any requested alignment below it */
+  gst_memory_init (GST_MEMORY_CAST (mem), params->flags, allocator, NULL,
+      map_size, params->align | HUGEPAGE_ALLOCATOR_ALIGN, params->prefix, size);
+  mem->data = data;
+  mem->map_size = map_size;
+
+  if ((params->flags & GST_MEMORY_FLAG_ZERO_PREFIXED) && params->prefix)
+    memset (data, 0, params->prefix);
+  if ((params->flags & GST_MEMORY_FLAG_ZERO_PADDED) && params->padding)
+    memset ((guint8 *) data + params->prefix + size, 0, params->padding);
+
+  return GST_MEMORY_CAST (mem);
+}
+
+static void
+hugepage_free (GstAllocator *allocator, GstMemory *memory)
+{
+  HugePageAllocator *self = (HugePageAllocator *) allocator;
+  HugePageMemory *mem = (HugePageMemory *) memory;
+
+  if (mem->map_size > 0) {
+    g_mutex_lock (&self->lock);
+    if (self->cache_len < HUGEPAGE_CACHE_MAX) {
+      HugePageBlock *block = g_slice_new (HugePageBlock);
+
+      block->data = mem->data;
+      block->map_size = mem->map_size;
+      self->cache = g_slist_prepend (self->cache, block);
+      self->cache_len++;
+    } else {
+      munmap (mem->data, mem->map_size);
+    }
+    g_mutex_unlock (&self->lock);
+  }
+
+  g_slice_free (HugePageMemory, mem);
+}
+
+static gpointer
+hugepage_mem_map (GstMemory *memory, gsize maxsize, GstMapFlags flags)
+{
+  return ((HugePageMemory *) memory)->data;
+}
+
+static void
+hugepage_mem_unmap (GstMemory *memory)
+{
+}
+
+static GstMemory *
+hugepage_mem_share (GstMemory *memory, gssize offset, gssize size)
+{
+  HugePageMemory *mem = (HugePageMemory *) memory;
+  HugePageMemory *sub;
+  GstMemory *parent;
+
+  if ((parent = memory->parent) == NULL)
+    parent = memory;
+
+  if (size == -1)
+    size = memory->size - offset;
+
+  sub = g_slice_new0 (HugePageMemory);
+  gst_memory_init (GST_MEMORY_CAST (sub),
+      GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      memory->allocator, parent, memory->maxsize, memory->align,
+      memory->offset + offset, size);
+  /* the parent owns the mapping */
+  sub->data = mem->data;
+  sub->map_size = 0;
+
+  return GST_MEMORY_CAST (sub);
+}
+
+static void
+hugepage_allocator_finalize (GObject *object)
+{
+  HugePageAllocator *self = (HugePageAllocator *) object;
+
+  GST_INFO_OBJECT (self, "%" G_GUINT64_FORMAT " huge page mappings, %"
+      G_GUINT64_FORMAT " regular mappings", self->hugetlb_maps, self->fallback_maps);
+
+  while (self->cache) {
+    HugePageBlock *block = self->cache->data;
+
+    munmap (block->data, block->map_size);
+    g_slice_free (HugePageBlock, block);
+    self->cache = g_slist_delete_link (self->cache, self->cache);
+  }
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (hugepage_allocator_parent_class)->finalize (object);
+}
+
+static void
+hugepage_allocator_class_init (HugePageAllocatorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+  gobject_class->finalize = hugepage_allocator_finalize;
+  allocator_class->alloc = hugepage_alloc;
+  allocator_class->free = hugepage_free;
+
+  GST_DEBUG_CATEGORY_INIT (hugepage_allocator_debug, "hugepage_allocator", 0,
+      "Huge page allocator");
+}
+
+static void
+hugepage_allocator_init (HugePageAllocator *self)
+{
+  GstAllocator *allocator = GST_ALLOCATOR_CAST (self);
+
+  allocator->mem_type = HUGEPAGE_ALLOCATOR_NAME;
+  allocator->mem_map = hugepage_mem_map;
+  allocator->mem_unmap = hugepage_mem_unmap;
+  allocator->mem_share = hugepage_mem_share;
+
+  g_mutex_init (&self->lock);
+}
+
+/**
+ * @brief Get the shared huge page allocator, creating and registering it on first use.
+ *
+ * The crop_scale plugin carries its own copy of this file. Looking the
+ * allocator up by name first keeps a single instance, and a single
+ * registered GType, when the plugin is loaded into the app.
+ *
+ * @return the allocator, unref after use.
+ */
+GstAllocator *
+hugepage_allocator_get (void)
+{
+  static GMutex lock;
+  GstAllocator *allocator;
+
+  g_mutex_lock (&lock);
+  allocator = gst_allocator_find (HUGEPAGE_ALLOCATOR_NAME);
+  if (!allocator) {
+    allocator = g_object_new (hugepage_allocator_get_type (), NULL);
+    gst_object_ref_sink (allocator);
+    gst_allocator_register (HUGEPAGE_ALLOCATOR_NAME, gst_object_ref (allocator));
+  }
+  g_mutex_unlock (&lock);
+
+  return allocator;
+}
+
+/**
+ * @brief Initialize allocation parameters for frame-sized buffers, 64-byte aligned.
+ */
+void
+hugepage_allocator_init_params (GstAllocationParams *params)
+{
+  gst_allocation_params_init (params);
+  params->align = HUGEPAGE_ALLOCATOR_ALIGN;
+}
@@ -0,0 +1,28 @@
+/**
+ * @file hugepage_allocator.h
+ * @brief GstAllocator for frame-sized buffers, backed by 2 MB huge pages.
+ *
+ * Memory is mapped with MAP_HUGETLB when huge pages are reserved on the
+ * host, otherwise with a regular mapping advised for transparent huge
+ * pages. Mappings are 64-byte aligned and recycled on free, so steady
+ * state streaming does not map or fault in new pages.
+ *
+ * The app and the crop_scale plugin share one instance, registered with
+ * gst_allocator_register() under HUGEPAGE_ALLOCATOR_NAME.
+ */
+#ifndef __HUGEPAGE_ALLOCATOR_H__
+#define __HUGEPAGE_ALLOCATOR_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define HUGEPAGE_ALLOCATOR_NAME   "FacemeshHugePage"
+#define HUGEPAGE_ALLOCATOR_ALIGN  (63) /* alignment mask, 64 bytes */
+
+GstAllocator *hugepage_allocator_get (void);
+void hugepage_allocator_init_params (GstAllocationParams *params);
+
+G_END_DECLS
+
+#endif /* __HUGEPAGE_ALLOCATOR_H__ */
@@ -0,0 +1,744 @@
+/**
+ * @file landmark_archive.c
+ * @brief Compact binary archive of per-frame face landmark results.
+ *
+ * Built into the app for the writer side and as liblandmarkarchive.so for
+ * consumer processes. See landmark_archive.h for the file layout.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "landmark_archive.h"
+
+/**
+ * @brief Integer columns of a frame besides the PTS and the landmarks.
+ */
+enum
+{
+  ARCHIVE_FIELD_CROP_X = 0,
+  ARCHIVE_FIELD_CROP_Y,
+  ARCHIVE_FIELD_CROP_W,
+  ARCHIVE_FIELD_CROP_H,
+  ARCHIVE_FIELD_ANGLE,
+  ARCHIVE_FIELD_SCORE,
+  ARCHIVE_NUM_FIELDS
+};
+
+/**
+ * @brief Quantized frames of a chunk, column by column.
+ */
+typedef struct
+{
+  uint32_t capacity; /**< frames per column */
+  uint32_t num_frames;
+  uint64_t *pts;
+  int32_t *fields; /**< ARCHIVE_NUM_FIELDS columns */
+  int16_t *coords; /**< LANDMARK_ARCHIVE_NUM_COORDS columns */
+} ArchiveChunk;
+
+struct _LandmarkArchiveWriter
+{
+  FILE *file;
+  LandmarkArchiveHeader header;
+  ArchiveChunk chunk;
+
+  uint8_t *buf; /**< encoded columns of the chunk being written */
+  size_t buf_size;
+
+  LandmarkArchiveIndexEntry *index;
+  uint64_t index_cap;
+  uint64_t offset; /**< file offset of the next chunk */
+  int failed; /**< a chunk could not be written, later frames are refused */
+};
+
+struct _LandmarkArchive
+{
+  void *map;
+  size_t map_size;
+  const LandmarkArchiveHeader *header;
+
+  const LandmarkArchiveIndexEntry *index;
+  LandmarkArchiveIndexEntry *index_owned; /**< index copied from the file or rebuilt by walking the chunks */
+  uint64_t num_chunks;
+  uint64_t num_frames;
+
+  ArchiveChunk chunk; /**< last decoded chunk */
+  int64_t chunk_idx; /**< index of the decoded chunk, -1 if none */
+};
+
+static int
+archive_chunk_init (ArchiveChunk *chunk, uint32_t capacity)
+{
+  chunk->capacity = capacity;
+  chunk->num_frames = 0;
+  chunk->pts = calloc (capacity, sizeof (uint64_t));
+  chunk->fields = calloc ((size_t) capacity * ARCHIVE_NUM_FIELDS, sizeof (int32_t));
+  chunk->coords = calloc ((size_t) capacity * LANDMARK_ARCHIVE_NUM_COORDS, sizeof (int16_t));
+
+  return (chunk->pts && chunk->fields && chunk->coords) ? 0 : -1;
+}
+
+static void
+archive_chunk_clear (ArchiveChunk *chunk)
+{
+  free (chunk->pts);
+  free (chunk->fields);
+  free (chunk->coords);
+  memset (chunk, 0, sizeof (ArchiveChunk));
+}
+
+static inline uint64_t
+zigzag_encode (int64_t v)
+{
+  return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t
+zigzag_decode (uint64_t v)
+{
+  return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static inline uint8_t *
+put_varint (uint8_t *p, uint64_t v)
+{
+  while (v >= 0x80) {
+    *p++ = (uint8_t) v | 0x80;
+    v >>= 7;
+  }
+  *p++ = (uint8_t) v;
+  return p;
+}
+
+/**
+ * @brief Read a varint, never past end.
+ * @return 0 on success, -1 if the data is truncated.
+ */
+static inline int
+get_varint (const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+  uint64_t result = 0;
+  unsigned int shift = 0;
+
+  while (*p < end && shift < 64) {
+    uint8_t byte = *(*p)++;
+
+    result |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *v = result;
+      return 0;
+    }
+    shift += 7;
+  }
+
+  return -1;
+}
+
+static inline int32_t
+quantize (float v, float scale, int32_t min, int32_t max)
+{
+  long q = lrintf (v * scale);
+
+  return q < min ? min : (q > max ? max : (int32_t) q);
+}
+
+/**
+ * @brief Upper bound of the encoded size of a chunk.
+ */
+static size_t
+archive_chunk_max_size (uint32_t num_frames)
+{
+  /* varints of a 64-bit, 32-bit and 17-bit zigzag delta */
+  return (size_t) num_frames * (10 + 5 * ARCHIVE_NUM_FIELDS + 3 * LANDMARK_ARCHIVE_NUM_COORDS);
+}
+
+/**
+ * @brief Encode the columns of a chunk, each as deltas with the previous frame.
+ * @return the encoded size.
+ */
+static size_t
+archive_chunk_encode (const ArchiveChunk *chunk, uint8_t *buf)
+{
+  uint8_t *p = buf;
+  uint32_t n = chunk->num_frames, f, k;
+
+  for (f = 0; f < n; f++)
+    p = put_varint (p, zigzag_encode ((int64_t) (chunk->pts[f] - (f ? chunk->pts[f - 1] : 0))));
+
+  for (k = 0; k < ARCHIVE_NUM_FIELDS; k++) {
+    const int32_t *col = chunk->fields + (size_t) k * chunk->capacity;
+
+    for (f = 0; f < n; f++)
+      p = put_varint (p, zigzag_encode ((int64_t) col[f] - (f ? col[f - 1] : 0)));
+  }
+
+  for (k = 0; k < LANDMARK_ARCHIVE_NUM_COORDS; k++) {
+    const int16_t *col = chunk->coords + (size_t) k * chunk->capacity;
+
+    for (f = 0; f < n; f++)
+      p = put_varint (p, zigzag_encode ((int32_t) col[f] - (f ? col[f - 1] : 0)));
+  }
+
+  return p - buf;
+}
+
+/**
+ * @brief Decode the columns of a chunk.
+ * @return 0 on success, -1 if the data is corrupted.
+ */
+static int
+archive_chunk_decode (ArchiveChunk *chunk, uint32_t num_frames, const uint8_t *p, const uint8_t *end)
+{
+  uint32_t f, k;
+  uint64_t v;
+
+  if (num_frames > chunk->capacity)
+    return -1;
+  chunk->num_frames = num_frames;
+
+  for (f = 0; f < num_frames; f++) {
+    if (get_varint (&p, end, &v) < 0)
+      return -1;
+    chunk->pts[f] = (f ? chunk->pts[f - 1] : 0) + (uint64_t) zigzag_decode (v);
+  }
+
+  for (k = 0; k < ARCHIVE_NUM_FIELDS; k++) {
+    int32_t *col = chunk->fields + (size_t) k * chunk->capacity;
+
+    for (f = 0; f < num_frames; f++) {
+      if (get_varint (&p, end, &v) < 0)
+        return -1;
+      col[f] = (int32_t) ((f ? col[f - 1] : 0) + zigzag_decode (v));
+    }
+  }
+
+  for (k = 0; k < LANDMARK_ARCHIVE_NUM_COORDS; k++) {
+    int16_t *col = chunk->coords + (size_t) k * chunk->capacity;
+
+    for (f = 0; f < num_frames; f++) {
+      if (get_varint (&p, end, &v) < 0)
+        return -1;
+      col[f] = (int16_t) ((f ? col[f - 1] : 0) + zigzag_decode (v));
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Write the buffered frames as a chunk and add it to the index.
+ *
+ * On failure the buffered frames are dropped and the writer is marked as
+ * failed, the chunks written before stay readable.
+ */
+static int
+landmark_archive_flush (LandmarkArchiveWriter *writer)
+{
+  ArchiveChunk *chunk = &writer->chunk;
+  LandmarkArchiveChunkHeader chunk_header = { 0 };
+  LandmarkArchiveIndexEntry *entry;
+  size_t size;
+
+  if (writer->failed)
+    return -1;
+  if (chunk->num_frames == 0)
+    return 0;
+
+  if (writer->header.num_chunks == writer->index_cap) {
+    uint64_t cap = writer->index_cap ? writer->index_cap * 2 : 256;
+    LandmarkArchiveIndexEntry *index = realloc (writer->index, cap * sizeof (LandmarkArchiveIndexEntry));
+
+    if (!index) {
+      fprintf (stderr, "landmark_archive: cannot grow the index\n");
+      chunk->num_frames = 0;
+      writer->failed = 1;
+      return -1;
+    }
+    writer->index = index;
+    writer->index_cap = cap;
+  }
+
+  size = archive_chunk_encode (chunk, writer->buf);
+
+  chunk_header.magic = LANDMARK_ARCHIVE_CHUNK_MAGIC;
+  chunk_header.num_frames = chunk->num_frames;
+  chunk_header.size = size;
+  chunk_header.first_pts = chunk->pts[0];
+
+  if (fwrite (&chunk_header, sizeof (chunk_header), 1, writer->file) != 1
+      || fwrite (writer->buf, 1, size, writer->file) != size) {
+    fprintf (stderr, "landmark_archive: write failed: %s\n", strerror (errno));
+    chunk->num_frames = 0;
+    writer->failed = 1;
+    return -1;
+  }
+
+  entry = &writer->index[writer->header.num_chunks++];
+  entry->offset = writer->offset;
+  entry->first_frame = writer->header.num_frames;
+  entry->first_pts = chunk->pts[0];
+  entry->num_frames = chunk->num_frames;
+  entry->size = size;
+
+  writer->offset += sizeof (chunk_header) + size;
+  writer->header.num_frames += chunk->num_frames;
+  chunk->num_frames = 0;
+
+  return 0;
+}
+
+/**
+ * @brief Create an archive file. The caller is the only writer.
+ * @param path file to create, truncated if it exists
+ * @param frames_per_chunk frames between two seek points, 0 for the default
+ * @return the writer handle, NULL on failure.
+ */
+LandmarkArchiveWriter *
+landmark_archive_create (const char *path, uint32_t frames_per_chunk)
+{
+  LandmarkArchiveWriter *writer;
+
+  if (frames_per_chunk == 0)
+    frames_per_chunk = LANDMARK_ARCHIVE_DEFAULT_CHUNK;
+
+  writer = calloc (1, sizeof (LandmarkArchiveWriter));
+  if (!writer)
+    return NULL;
+
+  writer->file = fopen (path, "wb");
+  if (!writer->file) {
+    fprintf (stderr, "landmark_archive: cannot create %s: %s\n", path, strerror (errno));
+    free (writer);
+    return NULL;
+  }
+
+  writer->buf_size = archive_chunk_max_size (frames_per_chunk);
+  writer->buf = malloc (writer->buf_size);
+  if (!writer->buf || archive_chunk_init (&writer->chunk, frames_per_chunk) < 0) {
+    fclose (writer->file);
+    archive_chunk_clear (&writer->chunk);
+    free (writer->buf);
+    free (writer);
+    return NULL;
+  }
+
+  writer->header.magic = LANDMARK_ARCHIVE_MAGIC;
+  writer->header.version = LANDMARK_ARCHIVE_VERSION;
+  writer->header.num_points = LANDMARK_ARCHIVE_NUM_POINTS;
+  writer->header.frames_per_chunk = frames_per_chunk;
+  writer->header.coord_scale = LANDMARK_ARCHIVE_COORD_SCALE;
+  writer->header.angle_scale = LANDMARK_ARCHIVE_ANGLE_SCALE;
+
+  /* index_offset stays 0 until landmark_archive_finish() */
+  fwrite (&writer->header, sizeof (writer->header), 1, writer->file);
+  writer->offset = sizeof (writer->header);
+
+  return writer;
+}
+
+/**
+ * @brief Append the result of a frame.
+ * @param pts buffer timestamp in ns, UINT64_MAX if unknown
+ * @param crop crop region in the source frame: x, y, w, h
+ * @param landmarks x, y, z of each point in landmark tensor coordinates
+ * @return 0 on success, -1 on write failure. After a failure every append fails.
+ */
+int
+landmark_archive_append (LandmarkArchiveWriter *writer, uint64_t pts,
+    const uint32_t crop[4], float angle, float score, const float *landmarks)
+{
+  ArchiveChunk *chunk = &writer->chunk;
+  uint32_t f = chunk->num_frames, k;
+  float scale = writer->header.coord_scale;
+
+  if (writer->failed)
+    return -1;
+
+  chunk->pts[f] = pts;
+  for (k = 0; k < 4; k++)
+    chunk->fields[(size_t) (ARCHIVE_FIELD_CROP_X + k) * chunk->capacity + f] = (int32_t) crop[k];
+  chunk->fields[(size_t) ARCHIVE_FIELD_ANGLE * chunk->capacity + f] =
+      quantize (angle, writer->header.angle_scale, INT32_MIN, INT32_MAX);
+  chunk->fields[(size_t) ARCHIVE_FIELD_SCORE * chunk->capacity + f] =
+      quantize (score, 65535.0f, 0, 65535);
+  for (k = 0; k < LANDMARK_ARCHIVE_NUM_COORDS; k++)
+    chunk->coords[(size_t) k * chunk->capacity + f] = quantize (landmarks[k], scale, INT16_MIN, INT16_MAX);
+
+  if (++chunk->num_frames == chunk->capacity)
+    return landmark_archive_flush (writer);
+
+  return 0;
+}
+
+/**
+ * @brief Number of bytes written to the file so far.
+ */
+uint64_t
+landmark_archive_get_bytes (LandmarkArchiveWriter *writer)
+{
+  return writer->offset;
+}
+
+/**
+ * @brief Write the last chunk and the index, and close the file.
+ * @return 0 on success, -1 if the file is incomplete.
+ */
+int
+landmark_archive_finish (LandmarkArchiveWriter *writer)
+{
+  int ret = 0;
+
+  if (!writer)
+    return 0;
+
+  if (landmark_archive_flush (writer) < 0)
+    ret = -1;
+
+  if (ret == 0) {
+    size_t n = writer->header.num_chunks;
+
+    writer->header.index_offset = writer->offset;
+    if (fwrite (writer->index, sizeof (LandmarkArchiveIndexEntry), n, writer->file) != n
+        || fseek (writer->file, 0, SEEK_SET) < 0
+        || fwrite (&writer->header, sizeof (writer->header), 1, writer->file) != 1) {
+      fprintf (stderr, "landmark_archive: cannot write the index: %s\n", strerror (errno));
+      ret = -1;
+    }
+  }
+
+  if (fclose (writer->file) != 0)
+    ret = -1;
+  archive_chunk_clear (&writer->chunk);
+  free (writer->buf);
+  free (writer->index);
+  free (writer);
+
+  return ret;
+}
+
+/**
+ * @brief Rebuild the index of an archive the writer did not finish.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int
+landmark_archive_scan (LandmarkArchive *archive)
+{
+  const uint8_t *base = archive->map;
+  uint64_t offset = sizeof (LandmarkArchiveHeader), cap = 0;
+
+  archive->num_chunks = 0;
+  archive->num_frames = 0;
+
+  while (offset + sizeof (LandmarkArchiveChunkHeader) <= archive->map_size) {
+    LandmarkArchiveChunkHeader chunk_header;
+    LandmarkArchiveIndexEntry *entry;
+
+    memcpy (&chunk_header, base + offset, sizeof (chunk_header));
+    if (chunk_header.magic != LANDMARK_ARCHIVE_CHUNK_MAGIC
+        || chunk_header.num_frames == 0
+        || chunk_header.num_frames > archive->header->frames_per_chunk
+        || offset + sizeof (chunk_header) + chunk_header.size > archive->map_size)
+      break; /* torn write at the end */
+
+    if (archive->num_chunks == cap) {
+      LandmarkArchiveIndexEntry *index;
+
+      cap = cap ? cap * 2 : 256;
+      index = realloc (archive->index_owned, cap * sizeof (LandmarkArchiveIndexEntry));
+      if (!index)
+        return -1;
+      archive->index_owned = index;
+    }
+
+    entry = &archive->index_owned[archive->num_chunks++];
+    entry->offset = offset;
+    entry->first_frame = archive->num_frames;
+    entry->first_pts = chunk_header.first_pts;
+    entry->num_frames = chunk_header.num_frames;
+    entry->size = chunk_header.size;
+
+    archive->num_frames += chunk_header.num_frames;
+    offset += sizeof (chunk_header) + chunk_header.size;
+  }
+
+  archive->index = archive->index_owned;
+  return 0;
+}
+
+/**
+ * @brief Copy and check the index written by the writer.
+ *
+ * The index sits at an arbitrary offset after the chunks, so the entries
+ * are copied out instead of used in place. Entries must follow each other
+ * frame by frame and stay within the file.
+ *
+ * @return 0 on success, 1 if the index is unusable, -1 on allocation failure.
+ */
+static int
+landmark_archive_load_index (LandmarkArchive *archive)
+{
+  const LandmarkArchiveHeader *header = archive->header;
+  uint64_t c, frames = 0;
+
+  if (header->index_offset < sizeof (LandmarkArchiveHeader)
+      || header->index_offset > archive->map_size
+      || header->num_chunks > (archive->map_size - header->index_offset)
+          / sizeof (LandmarkArchiveIndexEntry))
+    return 1;
+
+  archive->index_owned = malloc ((header->num_chunks ? header->num_chunks : 1)
+      * sizeof (LandmarkArchiveIndexEntry));
+  if (!archive->index_owned)
+    return -1;
+  memcpy (archive->index_owned, (const uint8_t *) archive->map + header->index_offset,
+      header->num_chunks * sizeof (LandmarkArchiveIndexEntry));
+
+  for (c = 0; c < header->num_chunks; c++) {
+    const LandmarkArchiveIndexEntry *entry = &archive->index_owned[c];
+
+    if (entry->first_frame != frames
+        || entry->num_frames == 0 || entry->num_frames > header->frames_per_chunk
+        || entry->offset < sizeof (LandmarkArchiveHeader)
+        || entry->offset > archive->map_size
+        || archive->map_size - entry->offset < sizeof (LandmarkArchiveChunkHeader) + entry->size)
+      return 1;
+    frames += entry->num_frames;
+  }
+
+  if (frames != header->num_frames)
+    return 1;
+
+  archive->index = archive->index_owned;
+  archive->num_chunks = header->num_chunks;
+  archive->num_frames = frames;
+  return 0;
+}
+
+/**
+ * @brief Map an archive for random access.
+ * @return the archive handle, NULL if it does not exist or is incompatible.
+ */
+LandmarkArchive *
+landmark_archive_open (const char *path)
+{
+  LandmarkArchive *archive;
+  const LandmarkArchiveHeader *header;
+  struct stat st;
+  void *addr;
+  int fd, ret;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0) {
+    fprintf (stderr, "landmark_archive: cannot open %s: %s\n", path, strerror (errno));
+    return NULL;
+  }
+
+  if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof (LandmarkArchiveHeader)) {
+    fprintf (stderr, "landmark_archive: %s is not a landmark archive\n", path);
+    close (fd);
+    return NULL;
+  }
+
+  addr = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (addr == MAP_FAILED) {
+    fprintf (stderr, "landmark_archive: cannot map %s: %s\n", path, strerror (errno));
+    return NULL;
+  }
+
+  header = addr;
+  if (header->magic != LANDMARK_ARCHIVE_MAGIC
+      || header->version != LANDMARK_ARCHIVE_VERSION
+      || header->num_points != LANDMARK_ARCHIVE_NUM_POINTS
+      || header->frames_per_chunk == 0) {
+    fprintf (stderr, "landmark_archive: %s has an incompatible layout\n", path);
+    munmap (addr, st.st_size);
+    return NULL;
+  }
+
+  archive = calloc (1, sizeof (LandmarkArchive));
+  if (!archive) {
+    munmap (addr, st.st_size);
+    return NULL;
+  }
+  archive->map = addr;
+  archive->map_size = st.st_size;
+  archive->header = header;
+  archive->chunk_idx = -1;
+
+  ret = header->index_offset > 0 ? landmark_archive_load_index (archive) : 1;
+  if (ret > 0) {
+    /* unfinished or damaged, walk the chunks instead */
+    if (header->index_offset > 0)
+      fprintf (stderr, "landmark_archive: %s has a damaged index, rebuilding it\n", path);
+    free (archive->index_owned);
+    archive->index_owned = NULL;
+    ret = landmark_archive_scan (archive);
+  }
+  if (ret < 0) {
+    landmark_archive_close (archive);
+    return NULL;
+  }
+
+  if (archive_chunk_init (&archive->chunk, header->frames_per_chunk) < 0) {
+    landmark_archive_close (archive);
+    return NULL;
+  }
+
+  /* chunks are decoded in file order when reading sequentially */
+  madvise (addr, st.st_size, MADV_SEQUENTIAL);
+
+  return archive;
+}
+
+/**
+ * @brief Number of frames in the archive.
+ */
+uint64_t
+landmark_archive_get_num_frames (LandmarkArchive *archive)
+{
+  return archive->num_frames;
+}
+
+/**
+ * @brief Decode a chunk, unless it is the last decoded one.
+ */
+static int
+landmark_archive_load_chunk (LandmarkArchive *archive, uint64_t chunk_idx)
+{
+  const LandmarkArchiveIndexEntry *entry = &archive->index[chunk_idx];
+  const uint8_t *p;
+
+  if (archive->chunk_idx == (int64_t) chunk_idx)
+    return 0;
+
+  if (entry->offset + sizeof (LandmarkArchiveChunkHeader) + entry->size > archive->map_size)
+    return -1;
+
+  p = (const uint8_t *) archive->map + entry->offset + sizeof (LandmarkArchiveChunkHeader);
+  archive->chunk_idx = -1;
+  if (archive_chunk_decode (&archive->chunk, entry->num_frames, p, p + entry->size) < 0) {
+    fprintf (stderr, "landmark_archive: chunk %llu is corrupted\n", (unsigned long long) chunk_idx);
+    return -1;
+  }
+  archive->chunk_idx = chunk_idx;
+
+  return 0;
+}
+
+/**
+ * @brief Find the chunk holding a frame.
+ */
+static uint64_t
+landmark_archive_chunk_of (LandmarkArchive *archive, uint64_t frame)
+{
+  uint64_t lo = 0, hi = archive->num_chunks;
+
+  /* last chunk whose first frame is not after the frame */
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+
+    if (archive->index[mid].first_frame <= frame)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/**
+ * @brief Read a frame by its number.
+ * @return 0 on success, -1 if the frame does not exist or is corrupted.
+ */
+int
+landmark_archive_read (LandmarkArchive *archive, uint64_t frame, LandmarkArchiveFrame *out)
+{
+  const ArchiveChunk *chunk = &archive->chunk;
+  uint64_t chunk_idx;
+  uint32_t f, k;
+  float scale;
+
+  if (frame >= archive->num_frames)
+    return -1;
+
+  chunk_idx = landmark_archive_chunk_of (archive, frame);
+  if (landmark_archive_load_chunk (archive, chunk_idx) < 0)
+    return -1;
+
+  f = frame - archive->index[chunk_idx].first_frame;
+  if (f >= chunk->num_frames)
+    return -1;
+  out->pts = chunk->pts[f];
+  out->crop_x = chunk->fields[(size_t) ARCHIVE_FIELD_CROP_X * chunk->capacity + f];
+  out->crop_y = chunk->fields[(size_t) ARCHIVE_FIELD_CROP_Y * chunk->capacity + f];
+  out->crop_w = chunk->fields[(size_t) ARCHIVE_FIELD_CROP_W * chunk->capacity + f];
+  out->crop_h = chunk->fields[(size_t) ARCHIVE_FIELD_CROP_H * chunk->capacity + f];
+  out->angle = chunk->fields[(size_t) ARCHIVE_FIELD_ANGLE * chunk->capacity + f]
+      / archive->header->angle_scale;
+  out->score = chunk->fields[(size_t) ARCHIVE_FIELD_SCORE * chunk->capacity + f] / 65535.0f;
+
+  scale = 1.0f / archive->header->coord_scale;
+  for (k = 0; k < LANDMARK_ARCHIVE_NUM_COORDS; k++)
+    out->landmarks[k] = chunk->coords[(size_t) k * chunk->capacity + f] * scale;
+
+  return 0;
+}
+
+/**
+ * @brief Find the first frame at or after a timestamp. Frames must be in PTS order.
+ * @return the frame number, -1 if every frame is before pts.
+ */
+int64_t
+landmark_archive_find_pts (LandmarkArchive *archive, uint64_t pts)
+{
+  uint64_t lo = 0, hi = archive->num_chunks, c;
+  uint32_t f;
+
+  if (archive->num_chunks == 0)
+    return -1;
+
+  /* last chunk starting at or before pts, its frames may still be before pts */
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+
+    if (archive->index[mid].first_pts <= pts)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  for (c = lo; c < archive->num_chunks; c++) {
+    if (landmark_archive_load_chunk (archive, c) < 0)
+      return -1;
+
+    for (f = 0; f < archive->chunk.num_frames; f++) {
+      if (archive->chunk.pts[f] >= pts)
+        return archive->index[c].first_frame + f;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * @brief Unmap the archive.
+ */
+void
+landmark_archive_close (LandmarkArchive *archive)
+{
+  if (!archive)
+    return;
+
+  munmap (archive->map, archive->map_size);
+  archive_chunk_clear (&archive->chunk);
+  free (archive->index_owned);
+  free (archive);
+}
@@ -0,0 +1,123 @@
+/**
+ * @file landmark_archive.h
+ * @brief Compact binary archive of per-frame face landmark results.
+ *
+ * Frames are stored in chunks. Within a chunk the values are columnar:
+ * all the PTS first, then each crop field, the angle, the score and each
+ * landmark coordinate, every column as zigzag varints of the difference
+ * with the previous frame. Landmarks are quantized to int16 in landmark
+ * tensor coordinates, which are relative to the crop, so a still face
+ * costs about one byte per coordinate and frame.
+ *
+ * Every chunk starts from zero and decodes on its own. An index of the
+ * chunks is written at the end of the file, so the reader maps the file
+ * and seeks to any frame or PTS by decoding a single chunk. If the writer
+ * did not finish, the reader rebuilds the index by walking the chunks.
+ *
+ * This header has no GLib dependency so that consumers can use it with
+ * nothing but libc.
+ */
+#ifndef __LANDMARK_ARCHIVE_H__
+#define __LANDMARK_ARCHIVE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LANDMARK_ARCHIVE_MAGIC          (0x414c4d46U) /* "FMLA" */
+#define LANDMARK_ARCHIVE_CHUNK_MAGIC    (0x434c4d46U) /* "FMLC" */
+#define LANDMARK_ARCHIVE_VERSION        (1U)
+#define LANDMARK_ARCHIVE_NUM_POINTS     (468)
+#define LANDMARK_ARCHIVE_NUM_COORDS     (LANDMARK_ARCHIVE_NUM_POINTS * 3)
+#define LANDMARK_ARCHIVE_DEFAULT_CHUNK  (64U)
+
+/**
+ * @brief Quantization steps per landmark unit, 1/64 of a landmark tensor pixel.
+ */
+#define LANDMARK_ARCHIVE_COORD_SCALE    (64.0f)
+
+/**
+ * @brief Quantization steps per radian of the crop angle.
+ */
+#define LANDMARK_ARCHIVE_ANGLE_SCALE    (100000.0f)
+
+/**
+ * @brief Header at the start of the file.
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_points;
+  uint32_t frames_per_chunk; /**< max frames in a chunk */
+  float coord_scale; /**< quantization steps per landmark unit */
+  float angle_scale; /**< quantization steps per radian */
+  uint64_t num_frames;
+  uint64_t num_chunks;
+  uint64_t index_offset; /**< file offset of the chunk index, 0 if the writer did not finish */
+  uint8_t reserved[16];
+} LandmarkArchiveHeader;
+
+/**
+ * @brief Header of a chunk, followed by its encoded columns.
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint32_t num_frames;
+  uint32_t size; /**< size of the encoded columns in bytes */
+  uint32_t reserved;
+  uint64_t first_pts;
+} LandmarkArchiveChunkHeader;
+
+/**
+ * @brief Entry of the chunk index.
+ */
+typedef struct
+{
+  uint64_t offset; /**< file offset of the chunk header */
+  uint64_t first_frame; /**< number of the first frame in the chunk */
+  uint64_t first_pts;
+  uint32_t num_frames;
+  uint32_t size; /**< size of the encoded columns in bytes */
+} LandmarkArchiveIndexEntry;
+
+/**
+ * @brief Result of one frame, as returned by the reader.
+ */
+typedef struct
+{
+  uint64_t pts; /**< buffer timestamp in ns, UINT64_MAX if unknown */
+  uint32_t crop_x; /**< crop region in the source frame */
+  uint32_t crop_y;
+  uint32_t crop_w;
+  uint32_t crop_h;
+  float score; /**< face presence score in [0, 1] */
+  float angle; /**< crop rotation around its center in radians */
+  float landmarks[LANDMARK_ARCHIVE_NUM_COORDS]; /**< x, y, z in landmark tensor coordinates */
+} LandmarkArchiveFrame;
+
+typedef struct _LandmarkArchiveWriter LandmarkArchiveWriter;
+typedef struct _LandmarkArchive LandmarkArchive;
+
+/* Writer side, used by the pipeline */
+LandmarkArchiveWriter *landmark_archive_create (const char *path, uint32_t frames_per_chunk);
+int landmark_archive_append (LandmarkArchiveWriter *writer, uint64_t pts,
+    const uint32_t crop[4], float angle, float score, const float *landmarks);
+uint64_t landmark_archive_get_bytes (LandmarkArchiveWriter *writer);
+int landmark_archive_finish (LandmarkArchiveWriter *writer);
+
+/* Reader side */
+LandmarkArchive *landmark_archive_open (const char *path);
+uint64_t landmark_archive_get_num_frames (LandmarkArchive *archive);
+int landmark_archive_read (LandmarkArchive *archive, uint64_t frame, LandmarkArchiveFrame *out);
+int64_t landmark_archive_find_pts (LandmarkArchive *archive, uint64_t pts);
+void landmark_archive_close (LandmarkArchive *archive);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LANDMARK_ARCHIVE_H__ */
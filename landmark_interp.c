@@ -0,0 +1,152 @@
+#include <gst/gst.h>
+#include <math.h>
+#include <string.h>
+
+#define LANDMARK_INTERP_NUM_POINTS (468)
+#define LANDMARK_INTERP_NUM_COORDS (LANDMARK_INTERP_NUM_POINTS * 3)
+
+/**
+ * @brief Keyframes further apart than this are not used for the velocity, the last one is held.
+ */
+#define LANDMARK_INTERP_MAX_GAP (500 * GST_MSECOND)
+
+/**
+ * @brief Landmarks of a frame that went through the landmark model, in frame coordinates.
+ */
+typedef struct
+{
+  GstClockTime pts;
+  gfloat score; /**< raw presence score of the model, before the sigmoid */
+  gfloat points[LANDMARK_INTERP_NUM_COORDS];
+} LandmarkKeyframe;
+
+/**
+ * @brief Last two keyframes, the landmarks of the frames in between are extrapolated from them.
+ */
+typedef struct
+{
+  LandmarkKeyframe keys[2]; /**< keys[1] is the latest */
+  guint num_keys;
+} LandmarkInterp;
+
+/**
+ * @brief Crop region a landmark tensor is relative to.
+ */
+typedef struct
+{
+  guint crop[4]; /**< x, y, w, h in frame pixels */
+  gfloat angle; /**< rotation around the crop center in radians */
+  guint tensor_width; /**< size of the landmark model input */
+  guint tensor_height;
+} LandmarkCrop;
+
+/**
+ * @brief Map landmarks from landmark tensor coordinates to frame coordinates.
+ *
+ * The rotation matches the overlay of crop_scale: a crop point relative to
+ * the crop center is rotated by the angle around the crop center. z is
+ * scaled like x.
+ */
+static void
+landmark_interp_to_frame (const LandmarkCrop *c, const gfloat *in, gfloat *out)
+{
+  gfloat sx = (gfloat) c->crop[2] / c->tensor_width;
+  gfloat sy = (gfloat) c->crop[3] / c->tensor_height;
+  gfloat cx = c->crop[0] + c->crop[2] / 2.0f;
+  gfloat cy = c->crop[1] + c->crop[3] / 2.0f;
+  gfloat cs = cosf (c->angle);
+  gfloat sn = sinf (c->angle);
+  guint i;
+
+  for (i = 0; i < LANDMARK_INTERP_NUM_COORDS; i += 3) {
+    gfloat u = in[i] * sx - c->crop[2] / 2.0f;
+    gfloat v = in[i + 1] * sy - c->crop[3] / 2.0f;
+
+    out[i] = cx + u * cs - v * sn;
+    out[i + 1] = cy + u * sn + v * cs;
+    out[i + 2] = in[i + 2] * sx;
+  }
+}
+
+/**
+ * @brief Map landmarks from frame coordinates to the landmark tensor coordinates of a crop.
+ */
+static void
+landmark_interp_to_crop (const LandmarkCrop *c, const gfloat *in, gfloat *out)
+{
+  gfloat sx = (gfloat) c->tensor_width / MAX (c->crop[2], 1);
+  gfloat sy = (gfloat) c->tensor_height / MAX (c->crop[3], 1);
+  gfloat cx = c->crop[0] + c->crop[2] / 2.0f;
+  gfloat cy = c->crop[1] + c->crop[3] / 2.0f;
+  gfloat cs = cosf (c->angle);
+  gfloat sn = sinf (c->angle);
+  guint i;
+
+  for (i = 0; i < LANDMARK_INTERP_NUM_COORDS; i += 3) {
+    gfloat dx = in[i] - cx;
+    gfloat dy = in[i + 1] - cy;
+
+    out[i] = (dx * cs + dy * sn + c->crop[2] / 2.0f) * sx;
+    out[i + 1] = (-dx * sn + dy * cs + c->crop[3] / 2.0f) * sy;
+    out[i + 2] = in[i + 2] * sx;
+  }
+}
+
+/**
+ * @brief Add the result of the landmark model for a frame.
+ * @param landmarks landmarks in the tensor coordinates of the frame crop
+ */
+static void
+landmark_interp_add_key (LandmarkInterp *interp, GstClockTime pts, const LandmarkCrop *crop,
+    const gfloat *landmarks, gfloat score)
+{
+  LandmarkKeyframe *key;
+
+  if (interp->num_keys == 2)
+    interp->keys[0] = interp->keys[1];
+  key = &interp->keys[MIN (interp->num_keys, 1)];
+  interp->num_keys = MIN (interp->num_keys + 1, 2);
+
+  key->pts = pts;
+  key->score = score;
+  landmark_interp_to_frame (crop, landmarks, key->points);
+}
+
+/**
+ * @brief Extrapolate the landmarks of a frame after the latest keyframe.
+ *
+ * Each point moves at the velocity between the last two keyframes, for at
+ * most one keyframe interval. The latest keyframe is held when there is no
+ * usable velocity: a single keyframe, a long gap, or no face in either.
+ *
+ * @param[out] landmarks landmarks in the tensor coordinates of the frame crop
+ * @return FALSE if there is no keyframe yet.
+ */
+static gboolean
+landmark_interp_predict (LandmarkInterp *interp, GstClockTime pts, const LandmarkCrop *crop,
+    gfloat *landmarks, gfloat *score)
+{
+  const LandmarkKeyframe *k0 = &interp->keys[0];
+  const LandmarkKeyframe *k1 = &interp->keys[interp->num_keys - 1];
+  gfloat points[LANDMARK_INTERP_NUM_COORDS];
+  gfloat alpha = 0.0f;
+  guint i;
+
+  if (interp->num_keys == 0)
+    return FALSE;
+
+  if (interp->num_keys == 2 && GST_CLOCK_TIME_IS_VALID (pts)
+      && GST_CLOCK_TIME_IS_VALID (k0->pts) && GST_CLOCK_TIME_IS_VALID (k1->pts)
+      && k1->pts > k0->pts && pts > k1->pts && k1->pts - k0->pts <= LANDMARK_INTERP_MAX_GAP
+      && k0->score > 0.0f && k1->score > 0.0f) {
+    alpha = (gfloat) (pts - k1->pts) / (k1->pts - k0->pts);
+    alpha = MIN (alpha, 1.0f);
+  }
+
+  for (i = 0; i < LANDMARK_INTERP_NUM_COORDS; i++)
+    points[i] = k1->points[i] + (k1->points[i] - k0->points[i]) * alpha;
+
+  landmark_interp_to_crop (crop, points, landmarks);
+  *score = k1->score;
+  return TRUE;
+}
@@ -0,0 +1,293 @@
+/**
+ * @file landmark_ring.c
+ * @brief Shared-memory ring buffer of per-frame face landmark results.
+ *
+ * Built into the app for the writer side and as liblandmarkring.so for
+ * consumer processes. See landmark_ring.h for the memory layout.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "landmark_ring.h"
+
+#define ring_load(p)      __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define ring_store(p,v)   __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * @brief Handle of a mapped ring.
+ */
+struct _LandmarkRing
+{
+  char *name;
+  int is_writer;
+
+  size_t map_size;
+  LandmarkRingHeader *header;
+  LandmarkRingSlot *slots;
+  uint32_t num_slots; /**< private copy, the shared header is never trusted after open */
+
+  uint64_t next; /**< writer: sequence being written, reader: next to read */
+  uint64_t slot_seq; /**< reader: seqlock value of the slot in use */
+  uint64_t lost; /**< reader: slots skipped because they were overwritten */
+};
+
+/**
+ * @brief Map a shared memory object and fill the handle.
+ */
+static LandmarkRing *
+landmark_ring_map (const char *name, int fd, size_t size, int is_writer)
+{
+  LandmarkRing *ring;
+  void *addr;
+
+  addr = mmap (NULL, size, PROT_READ | (is_writer ? PROT_WRITE : 0),
+      MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf (stderr, "landmark_ring: cannot map %s: %s\n", name, strerror (errno));
+    return NULL;
+  }
+
+  ring = calloc (1, sizeof (LandmarkRing));
+  if (ring)
+    ring->name = strdup (name);
+  if (!ring || !ring->name) {
+    fprintf (stderr, "landmark_ring: out of memory\n");
+    free (ring);
+    munmap (addr, size);
+    return NULL;
+  }
+  ring->is_writer = is_writer;
+  ring->map_size = size;
+  ring->header = addr;
+  ring->slots = (LandmarkRingSlot *) ((char *) addr + sizeof (LandmarkRingHeader));
+
+  return ring;
+}
+
+/**
+ * @brief Create the shared memory ring. The caller is the only writer.
+ * @param name POSIX shared memory name (e.g. "/facemesh")
+ * @param num_slots number of result slots, 0 for the default
+ * @return the ring handle, NULL on failure.
+ */
+LandmarkRing *
+landmark_ring_create (const char *name, uint32_t num_slots)
+{
+  LandmarkRing *ring;
+  size_t size;
+  int fd;
+
+  if (num_slots == 0)
+    num_slots = LANDMARK_RING_DEFAULT_SLOTS;
+
+  size = sizeof (LandmarkRingHeader) + (size_t) num_slots * sizeof (LandmarkRingSlot);
+
+  fd = shm_open (name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf (stderr, "landmark_ring: cannot create %s: %s\n", name, strerror (errno));
+    return NULL;
+  }
+
+  if (ftruncate (fd, size) < 0) {
+    fprintf (stderr, "landmark_ring: cannot resize %s: %s\n", name, strerror (errno));
+    close (fd);
+    shm_unlink (name);
+    return NULL;
+  }
+
+  ring = landmark_ring_map (name, fd, size, 1);
+  close (fd);
+  if (!ring) {
+    shm_unlink (name);
+    return NULL;
+  }
+
+  ring->num_slots = num_slots;
+  ring->header->version = LANDMARK_RING_VERSION;
+  ring->header->num_slots = num_slots;
+  ring->header->slot_size = sizeof (LandmarkRingSlot);
+  /* publish the magic last, readers check it before anything else */
+  ring_store (&ring->header->magic, LANDMARK_RING_MAGIC);
+
+  return ring;
+}
+
+/**
+ * @brief Get the next slot to fill. Never blocks.
+ *
+ * The slot stays invalid for readers until landmark_ring_commit() is called.
+ */
+LandmarkRingSlot *
+landmark_ring_begin_write (LandmarkRing *ring)
+{
+  LandmarkRingSlot *slot;
+  uint64_t seq = ring->next;
+
+  slot = &ring->slots[seq % ring->num_slots];
+  __atomic_store_n (&slot->seq, 2 * seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  return slot;
+}
+
+/**
+ * @brief Make the slot returned by landmark_ring_begin_write() visible.
+ */
+void
+landmark_ring_commit (LandmarkRing *ring)
+{
+  uint64_t seq = ring->next++;
+  LandmarkRingSlot *slot = &ring->slots[seq % ring->num_slots];
+
+  ring_store (&slot->seq, 2 * seq + 2);
+  ring_store (&ring->header->write_seq, seq + 1);
+}
+
+/**
+ * @brief Attach to a ring created by the pipeline.
+ * @return the ring handle, NULL if it does not exist or is incompatible.
+ */
+LandmarkRing *
+landmark_ring_open (const char *name)
+{
+  LandmarkRing *ring;
+  LandmarkRingHeader header;
+  struct stat st;
+  int fd;
+
+  fd = shm_open (name, O_RDONLY, 0);
+  if (fd < 0) {
+    fprintf (stderr, "landmark_ring: cannot open %s: %s\n", name, strerror (errno));
+    return NULL;
+  }
+
+  if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof (LandmarkRingHeader)) {
+    fprintf (stderr, "landmark_ring: %s is not a landmark ring\n", name);
+    close (fd);
+    return NULL;
+  }
+
+  if (pread (fd, &header, sizeof (header), 0) != sizeof (header)
+      || header.magic != LANDMARK_RING_MAGIC
+      || header.version != LANDMARK_RING_VERSION
+      || header.slot_size != sizeof (LandmarkRingSlot)
+      || header.num_slots == 0
+      || (size_t) st.st_size < sizeof (header) + (size_t) header.num_slots * header.slot_size) {
+    fprintf (stderr, "landmark_ring: %s has an incompatible layout\n", name);
+    close (fd);
+    return NULL;
+  }
+
+  /* a reader cannot disturb the writer or the other readers */
+  ring = landmark_ring_map (name, fd, st.st_size, 0);
+  close (fd);
+  if (!ring)
+    return NULL;
+
+  ring->num_slots = header.num_slots;
+  ring->next = ring_load (&ring->header->write_seq);
+
+  return ring;
+}
+
+/**
+ * @brief Get the oldest unread result without copying it.
+ *
+ * The slot must be handed back with landmark_ring_release(), which tells
+ * whether the writer overwrote it while it was in use.
+ *
+ * @return 1 if a slot is available, 0 if the reader has caught up.
+ */
+int
+landmark_ring_next (LandmarkRing *ring, const LandmarkRingSlot **slot)
+{
+  uint64_t head, seq;
+
+  for (;;) {
+    head = ring_load (&ring->header->write_seq);
+    if (ring->next >= head)
+      return 0;
+
+    /* too far behind, skip what has been overwritten already */
+    if (head - ring->next > ring->num_slots) {
+      ring->lost += head - ring->num_slots - ring->next;
+      ring->next = head - ring->num_slots;
+    }
+
+    *slot = &ring->slots[ring->next % ring->num_slots];
+    seq = ring_load (&(*slot)->seq);
+    if (seq == 2 * ring->next + 2) {
+      ring->slot_seq = seq;
+      return 1;
+    }
+
+    /* overwritten between reading head and the slot */
+    ring->lost++;
+    ring->next++;
+  }
+}
+
+/**
+ * @brief Hand back a slot obtained with landmark_ring_next().
+ * @return 1 if the slot contents were consistent, 0 if the data read from
+ *         it must be discarded.
+ */
+int
+landmark_ring_release (LandmarkRing *ring, const LandmarkRingSlot *slot)
+{
+  uint64_t seq;
+  int valid;
+
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  seq = __atomic_load_n (&slot->seq, __ATOMIC_RELAXED);
+  valid = (seq == ring->slot_seq);
+  if (!valid)
+    ring->lost++;
+
+  ring->next++;
+  return valid;
+}
+
+/**
+ * @brief Number of results this reader missed because they were overwritten.
+ *
+ * Counted from the gaps in the sequence numbers, so each reader has its
+ * own count and the writer does not need to know the readers.
+ */
+uint64_t
+landmark_ring_get_lost (LandmarkRing *ring)
+{
+  return ring->lost;
+}
+
+/**
+ * @brief Number of results committed so far.
+ */
+uint64_t
+landmark_ring_get_written (LandmarkRing *ring)
+{
+  return ring_load (&ring->header->write_seq);
+}
+
+/**
+ * @brief Unmap the ring. The writer also removes the shared memory object.
+ */
+void
+landmark_ring_close (LandmarkRing *ring)
+{
+  if (!ring)
+    return;
+
+  if (ring->is_writer)
+    shm_unlink (ring->name);
+
+  munmap (ring->header, ring->map_size);
+  free (ring->name);
+  free (ring);
+}
@@ -0,0 +1,83 @@
+/**
+ * @file landmark_ring.h
+ * @brief Shared-memory ring buffer of per-frame face landmark results.
+ *
+ * The pipeline is the only writer. Any number of processes may map the
+ * same ring read-only and read it without copies. The writer never waits
+ * for a reader: when the ring is full the oldest slot is overwritten. Each
+ * reader keeps its own position and counts the results it missed from the
+ * gaps in the sequence numbers.
+ *
+ * Each slot is guarded by a sequence counter (seqlock). The counter is odd
+ * while the writer fills the slot and even once it is committed. A reader
+ * checks the counter before and after using a slot. If it changed, the
+ * slot was overwritten in the meantime and its contents must be discarded.
+ *
+ * This header has no GLib dependency so that consumers can use it with
+ * nothing but libc.
+ */
+#ifndef __LANDMARK_RING_H__
+#define __LANDMARK_RING_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LANDMARK_RING_MAGIC         (0x464d5247U) /* "FMRG" */
+#define LANDMARK_RING_VERSION       (2U)
+#define LANDMARK_RING_NUM_POINTS    (468)
+#define LANDMARK_RING_NUM_COORDS    (LANDMARK_RING_NUM_POINTS * 3)
+#define LANDMARK_RING_DEFAULT_SLOTS (64U)
+
+/**
+ * @brief Result of one frame, as stored in the ring.
+ */
+typedef struct
+{
+  uint64_t seq; /**< seqlock counter, do not access directly */
+  uint64_t pts; /**< buffer timestamp in ns, UINT64_MAX if unknown */
+  uint32_t crop_x; /**< crop region in the source frame */
+  uint32_t crop_y;
+  uint32_t crop_w;
+  uint32_t crop_h;
+  float score; /**< face presence score in [0, 1] */
+  float angle; /**< crop rotation around its center in radians, 0 for an upright crop */
+  float landmarks[LANDMARK_RING_NUM_COORDS]; /**< x, y, z in landmark tensor coordinates */
+} __attribute__ ((aligned (64))) LandmarkRingSlot;
+
+/**
+ * @brief Header at the start of the shared memory object.
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_slots;
+  uint32_t slot_size;
+  uint64_t write_seq; /**< number of committed slots */
+} __attribute__ ((aligned (64))) LandmarkRingHeader;
+
+typedef struct _LandmarkRing LandmarkRing;
+
+/* Writer side, used by the pipeline */
+LandmarkRing *landmark_ring_create (const char *name, uint32_t num_slots);
+LandmarkRingSlot *landmark_ring_begin_write (LandmarkRing *ring);
+void landmark_ring_commit (LandmarkRing *ring);
+
+/* Reader side */
+LandmarkRing *landmark_ring_open (const char *name);
+int landmark_ring_next (LandmarkRing *ring, const LandmarkRingSlot **slot);
+int landmark_ring_release (LandmarkRing *ring, const LandmarkRingSlot *slot);
+uint64_t landmark_ring_get_lost (LandmarkRing *ring);
+
+/* Both sides */
+uint64_t landmark_ring_get_written (LandmarkRing *ring);
+void landmark_ring_close (LandmarkRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LANDMARK_RING_H__ */
@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sched_getaffinity */
+#endif
+
 #include <gst/gst.h>
 #include <nnstreamer/nnstreamer_plugin_api_decoder.h>
 #include <nnstreamer/nnstreamer_plugin_api_util.h>
@@ -7,10 +11,28 @@
 #include <nnstreamer/tensor_filter_custom_easy.h>
 #include <nnstreamer/tensor_typedef.h>
 #include <nnstreamer/nnstreamer_util.h>
+#include <gst/app/gstappsrc.h>
+#include <glib-unix.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "face_detect.c"
+#include "affine_warp.c"
+#include "landmark_ring.c"
+#include "landmark_archive.c"
+#include "model_bench.c"
+#include "alloc_trace.c"
+#include "landmark_interp.c"
+#include "gstcropscale.h"
+#include "hugepage_allocator.h"
 
 /**
  * @brief Macro for debug mode.
@@ -30,6 +52,7 @@
 typedef struct
 {
   gchar *model_path;
+  ModelInputType input_type;
 
   guint tensor_width;
   guint tensor_height;
@@ -38,6 +61,286 @@ typedef struct
   guint i_height;
 } LandmarkModelInfo;
 
+/**
+ * @brief Crop info of a recent frame, used to pair it with the landmark result.
+ */
+typedef struct
+{
+  GstClockTime pts;
+  guint crop[4];
+  gfloat angle;
+} CropInfoRecord;
+
+/**
+ * @brief Number of crop info elements: x, y, w, h and the rotation in rotated crop mode.
+ */
+#define CROP_INFO_LEN(app) ((app)->rotate_crop ? 5 : 4)
+#define CROP_INFO_MAX_LEN (5)
+
+/**
+ * @brief Crop info kept for the landmark results, covers the frames queued around a detector batch.
+ */
+#define CROP_HISTORY_SIZE (MAX (64, 4 * (DETECT_BATCH_MAX + BATCH_QUEUE_SIZE)))
+
+/**
+ * @brief Margin added around the detected face, relative to its size.
+ */
+#define CROP_MARGIN_RATE (0.25f)
+
+/**
+ * @brief Margin in async detection mode, also covers the face motion of one frame.
+ */
+#define ASYNC_CROP_MARGIN_RATE (0.35f)
+
+/**
+ * @brief Size of the detection search window, relative to the last detected face.
+ */
+#define SEARCH_WINDOW_SCALE (3.0f)
+
+/**
+ * @brief Default number of detections between two full-frame scans in search window mode.
+ */
+#define DEFAULT_FULL_SCAN_INTERVAL (15)
+
+/**
+ * @brief Max number of landmark interpreter instances.
+ */
+#define LANDMARK_INSTANCES_MAX (8)
+
+/**
+ * @brief Queue depth of each landmark instance when there are several.
+ */
+#define LANDMARK_INSTANCE_QUEUE_SIZE (4)
+
+/**
+ * @brief Capacity of the landmark reorder stage, in frames.
+ *
+ * Each instance holds its queue and one frame in its streaming thread, the
+ * slack covers the frame being dispatched. Every frame in flight fits, so
+ * the result of a dispatched frame always finds its entry.
+ */
+#define LANDMARK_REORDER_SIZE (LANDMARK_INSTANCES_MAX * (LANDMARK_INSTANCE_QUEUE_SIZE + 2))
+
+/**
+ * @brief Max number of frames per detector invoke in batch mode.
+ */
+#define DETECT_BATCH_MAX (16)
+
+/**
+ * @brief Capacity of the PTS queue of batched detection, in frames.
+ */
+#define DETECT_BATCH_PTS_SIZE (4 * DETECT_BATCH_MAX)
+
+/**
+ * @brief Landmark result waiting in the reorder stage.
+ */
+typedef struct
+{
+  GstClockTime pts;
+  GstBuffer *buffer;
+} LandmarkReorderEntry;
+
+/**
+ * @brief Frame dealt to a landmark instance, waiting for its result.
+ */
+typedef struct
+{
+  GstClockTime pts;
+  guint64 seq; /**< dispatch sequence number, the frame went to instance seq % landmark_instances */
+} LandmarkReorderFrame;
+
+/**
+ * @brief Nearest-neighbor index tables for a fixed input and output geometry.
+ */
+typedef struct
+{
+  guint in_width;
+  guint in_height;
+  guint out_width;
+  guint out_height;
+  guint *x_offset; /**< input byte offset in a row, for each output column */
+  guint *y_offset; /**< input byte offset of the row, for each output row */
+  guint64 rebuilds; /**< number of times the tables were computed */
+} ScalePlan;
+
+/**
+ * @brief Queue and latency settings of the pipeline.
+ */
+typedef enum
+{
+  PIPELINE_PROFILE_DEFAULT = 0, /**< GStreamer defaults */
+  PIPELINE_PROFILE_REALTIME, /**< 1-deep leaky queues, no clock sync, QoS dropping */
+  PIPELINE_PROFILE_THROUGHPUT, /**< deep blocking queues, no clock sync */
+  PIPELINE_PROFILE_BATCH, /**< shallow blocking queues, no clock sync, used in batch mode */
+} PipelineProfile;
+
+#define THROUGHPUT_QUEUE_SIZE (64)
+
+/**
+ * @brief Queue size in batch mode, keeps crop info within CROP_HISTORY_SIZE of its landmark result.
+ */
+#define BATCH_QUEUE_SIZE (4)
+
+/**
+ * @brief Max timestamp difference in ms when pairing frames and crop info in realtime profile.
+ */
+#define REALTIME_LATENESS (5)
+
+/**
+ * @brief Branch of the pipeline a queue feeds, named after what runs behind it.
+ */
+typedef enum
+{
+  QUEUE_BRANCH_DETECT = 0,
+  QUEUE_BRANCH_CROP,
+  QUEUE_BRANCH_LANDMARK,
+  QUEUE_BRANCH_RESULT,
+  QUEUE_BRANCH_NUM
+} QueueBranch;
+
+/**
+ * @brief Branches of the streaming threads: the queue branches and the source thread.
+ */
+#define THREAD_BRANCH_SOURCE (QUEUE_BRANCH_NUM)
+#define THREAD_BRANCH_NUM (QUEUE_BRANCH_NUM + 1)
+
+/**
+ * @brief CPU set and scheduling policy of the streaming threads of a branch.
+ */
+typedef struct
+{
+  gboolean has_cpus;
+  cpu_set_t cpus;
+  gboolean has_policy;
+  gint policy; /**< SCHED_OTHER with nice, SCHED_FIFO or SCHED_RR */
+  gint priority; /**< nice value for SCHED_OTHER, realtime priority otherwise */
+} ThreadPolicy;
+
+/**
+ * @brief Interval of the queue level samples, in ms.
+ */
+#define QUEUE_MONITOR_SAMPLE_MS (200)
+
+/**
+ * @brief Statistics of a queue in the pipeline.
+ */
+typedef struct
+{
+  GstElement *queue;
+  QueueBranch branch;
+  gint overruns; /**< times the queue was full, buffers dropped if leaky */
+  gint underruns; /**< times the queue ran empty */
+
+  /* rolling window of the queue monitor, reset on each report */
+  gdouble fill_sum; /**< sum of the sampled fill ratios */
+  guint64 level_time_sum; /**< sum of the sampled queued durations in ns */
+  guint samples;
+  gint window_overruns; /**< overruns at the start of the window */
+  gint window_underruns;
+} QueueStats;
+
+/**
+ * @brief Name of the element message with the detection postprocess statistics.
+ */
+#define DETECT_STATS_MESSAGE "facemesh-detect-stats"
+
+/**
+ * @brief How detection statistics are posted.
+ */
+typedef enum
+{
+  DETECT_STATS_OFF = 0,
+  DETECT_STATS_FRAME, /**< one message per frame */
+  DETECT_STATS_SECOND, /**< one message per second, aggregated */
+} DetectStatsMode;
+
+/**
+ * @brief Detection postprocess statistics, accumulated until posted.
+ */
+typedef struct
+{
+  guint frames;
+  guint64 candidates; /**< anchors above the score threshold */
+  guint max_candidates;
+  guint64 faces; /**< detections left after NMS */
+  GstClockTime decode_time;
+  GstClockTime max_decode_time;
+  GstClockTime nms_time;
+  GstClockTime max_nms_time;
+  GstClockTime window_start; /**< start of the aggregation window */
+} DetectStats;
+
+/**
+ * @brief Stages the adaptive controller thins out, in the order they are degraded.
+ */
+typedef enum
+{
+  ADAPT_STAGE_DETECT = 0, /**< detector cadence, the frames in between are cropped with the latest detection */
+  ADAPT_STAGE_PREVIEW, /**< preview render rate */
+  ADAPT_STAGE_LANDMARK, /**< landmark rate */
+  ADAPT_STAGE_SOURCE, /**< frame rate entering the pipeline */
+  ADAPT_STAGE_NUM
+} AdaptStage;
+
+/**
+ * @brief Keep one frame out of N for each stage, per degradation level.
+ */
+static const guint adapt_levels[][ADAPT_STAGE_NUM] = {
+  { 1, 1, 1, 1 },
+  { 2, 1, 1, 1 },
+  { 3, 1, 1, 1 },
+  { 3, 2, 1, 1 },
+  { 3, 3, 1, 1 },
+  { 3, 3, 2, 1 },
+  { 3, 3, 2, 2 },
+};
+
+#define ADAPT_NUM_LEVELS G_N_ELEMENTS (adapt_levels)
+
+/**
+ * @brief Process CPU load, relative to the CPU budget, above which the controller degrades.
+ */
+#define ADAPT_CPU_HIGH (0.9)
+
+/**
+ * @brief The controller steps back up below this CPU load and this fraction of the latency budget.
+ */
+#define ADAPT_CPU_LOW (0.6)
+#define ADAPT_LATENCY_HEADROOM (0.6)
+
+/**
+ * @brief Seconds of headroom before the controller steps back up.
+ */
+#define ADAPT_CALM_SECONDS (5)
+
+/**
+ * @brief State of the adaptive quality controller.
+ */
+typedef struct
+{
+  guint level; /**< index in adapt_levels */
+  guint keep[ADAPT_STAGE_NUM]; /**< keep one frame out of N, read by the pad probes */
+  guint calm; /**< consecutive seconds with headroom */
+  guint source_id;
+  guint cpus; /**< CPU budget of the process */
+
+  GMutex lock; /**< lock for the latency window */
+  GstClockTime latency_max; /**< max frame latency in the current second */
+  guint latency_count;
+
+  gint64 last_wall_us;
+  gint64 last_cpu_us;
+} AdaptState;
+
+/**
+ * @brief Frame counter of a pad thinned out by the adaptive controller.
+ */
+typedef struct
+{
+  const guint *keep; /**< keep one frame out of N */
+  guint count;
+} AdaptProbe;
+
 /**
  * @brief Data structure for app.
  */
@@ -46,7 +349,112 @@ typedef struct
   BlazeFaceInfo detect_model;
   LandmarkModelInfo landmark_model;
 
-  guint video_size;
+  guint video_width; /**< size of the RGB frames in the pipeline */
+  guint video_height;
+  gint capture_width; /**< camera geometry, 0 to crop and scale to a 720x720 square */
+  gint capture_height;
+  gchar *capture_format; /**< camera raw video format, NULL for any */
+
+  gchar *detect_model_path; /**< detection model file, NULL for the default */
+  gchar *detect_input; /**< input type of the detection model */
+  gchar *landmark_model_path; /**< landmark model file, NULL for the default */
+  gchar *landmark_input; /**< input type of the landmark model */
+  InferenceOptions detect_inference; /**< tflite options of the detection model */
+  InferenceOptions landmark_inference; /**< tflite options of the landmark model */
+  gboolean autotune; /**< benchmark inference options at startup */
+  gboolean warmup; /**< load and warm up the models before the camera starts */
+  gboolean minimal_registry; /**< do not rescan the plugin directories at startup */
+  gchar *profile_name; /**< name of the pipeline profile */
+  PipelineProfile profile;
+  GPtrArray *queue_stats; /**< QueueStats of every queue in the pipeline */
+  gchar **thread_affinity; /**< BRANCH=CPUS entries */
+  gchar **thread_sched; /**< BRANCH=POLICY entries */
+  ThreadPolicy thread_policies[THREAD_BRANCH_NUM];
+  gint latency_budget; /**< end-to-end latency target in ms, 0 to disable the adaptive controller */
+  AdaptState adapt;
+  gint queue_monitor; /**< seconds between queue monitor reports, 0 if disabled */
+  guint queue_monitor_id; /**< source of the queue monitor */
+  guint queue_monitor_ticks; /**< samples since the last report */
+  gchar *detect_stats_mode; /**< off, frame or second */
+  DetectStatsMode detect_stats;
+  DetectStats detect_stats_acc; /**< updated in the crop info streaming thread only */
+  GstElement *detect_stats_element; /**< element posting the detection statistics */
+  gboolean trace_alloc; /**< account memory allocations per element */
+  AllocTrace *alloc_trace;
+  ModelWarmup detect_warmup;
+  ModelWarmup landmark_warmup;
+  guint model_swap_id; /**< SIGHUP source that reloads the models */
+  GThread *model_swap_thread; /**< thread loading the models of the last swap */
+  gint model_swap_busy; /**< a swap is in progress, atomic */
+  gint64 start_time; /**< monotonic time when the app started */
+
+  gchar *result_shm; /**< shm name of the landmark result ring, NULL if disabled */
+  guint result_shm_slots; /**< number of slots in the result ring */
+  LandmarkRing *result_ring; /**< landmark result ring for other processes */
+  gchar *result_archive; /**< landmark archive file, NULL if disabled */
+  LandmarkArchiveWriter *archive; /**< landmark archive of this pipeline */
+
+  GMutex result_lock; /**< lock for crop info history */
+  CropInfoRecord crop_history[CROP_HISTORY_SIZE]; /**< crop info of recent frames */
+  guint crop_history_idx; /**< next index to write in crop_history */
+  guint64 crop_history_misses; /**< landmark results dropped because their crop info was not found */
+
+  gboolean async_detect; /**< crop frame N with the detection of frame N-1 */
+  GMutex latest_lock; /**< lock for latest_crop */
+  guint latest_crop[CROP_INFO_MAX_LEN]; /**< crop info of the latest detection */
+
+  gboolean rotate_crop; /**< align the crop with the eye line and warp it in one pass */
+
+  gboolean search_window; /**< run the detector on a window around the last face */
+  guint full_scan_interval; /**< detections between two full-frame scans */
+  guint detect_frames; /**< number of frames given to the detector */
+  detectedObject last_face; /**< face found by the last detection, invalid if none */
+  detectedObject detect_window; /**< region of the frame given to the detector */
+
+  guint landmark_instances; /**< number of landmark interpreter instances */
+  guint64 landmark_dispatch_seq; /**< sequence number of the frame being dispatched */
+  GstElement *landmark_reorder_src; /**< appsrc pushing landmark results in PTS order */
+  GMutex reorder_lock; /**< lock for the reorder stage */
+  LandmarkReorderFrame reorder_expected[LANDMARK_REORDER_SIZE]; /**< dispatched frames, in order */
+  guint reorder_expected_head;
+  guint reorder_expected_len;
+  LandmarkReorderEntry reorder_pending[LANDMARK_REORDER_SIZE]; /**< results waiting for their turn */
+  guint reorder_pending_len;
+  GstClockTime reorder_last_pts; /**< PTS of the last pushed result */
+  guint64 reorder_received[LANDMARK_INSTANCES_MAX]; /**< 1 + sequence of the latest result of each instance, 0 if none */
+  guint reorder_eos; /**< number of instances which reached EOS */
+  gboolean reorder_caps_set;
+
+  guint landmark_interval; /**< run the landmark model on one frame out of N, 0 or 1 for every frame */
+  guint landmark_interval_seq; /**< frames seen by the landmark branch */
+  LandmarkInterp landmark_interp; /**< used in the landmark streaming thread only */
+  GstElement *landmark_interp_src; /**< appsrc pushing the inferred and the extrapolated landmarks */
+  gboolean landmark_interp_caps_set;
+  gsize landmark_interp_sizes[2]; /**< size of the landmark and the score tensors */
+  guint64 landmark_inferred; /**< frames that went through the landmark model */
+  guint64 landmark_extrapolated; /**< frames with extrapolated landmarks */
+
+  guint detect_batch; /**< frames per detector invoke, batch mode only */
+  GMutex detect_batch_lock; /**< lock for the PTS queue of batched detection */
+  GstClockTime detect_batch_pts[DETECT_BATCH_PTS_SIZE]; /**< PTS of the frames given to the detector, in order */
+  guint detect_batch_pts_head;
+  guint detect_batch_pts_len;
+  GstElement *detect_unbatch_src; /**< appsrc pushing the detection of each frame */
+
+  guint crop_bucket; /**< crop size step in pixels, 0 to crop at the detected size */
+  detectedObject bucket_prev; /**< last bucketed crop, used for hysteresis */
+  ScalePlan flexible_plan; /**< scale plan of flexible_tensor_scale */
+  GstAllocator *frame_allocator; /**< huge page allocator of the buffers made by the app */
+
+  gchar **batch_inputs; /**< video files or directories to process offline, NULL for the camera */
+  gchar *batch_output; /**< directory of the batch result files */
+  gint batch_jobs; /**< pipelines running at once in batch mode, 0 for auto */
+  gchar *batch_uri; /**< input of this pipeline in batch mode, NULL for the camera */
+  gchar *name_suffix; /**< suffix of the custom filter names, unique per pipeline */
+  gboolean custom_registered; /**< the custom filters and decoder of this pipeline are registered */
+  gboolean batch_archive; /**< write landmark archives instead of CSV in batch mode */
+  FILE *batch_file; /**< per-frame results of this pipeline in batch mode */
+  guint64 batch_frames; /**< frames written in batch mode */
 
   GstElement *pipeline; /**< gst pipeline for data stream */
 
@@ -95,210 +503,2102 @@ request_compositor_and_link (GstElement *src, gchar *src_pad_name, GstElement *c
   return TRUE;
 }
 
-gboolean
-build_pipeline (AppData *app)
+/**
+ * @brief Get the name of a custom filter or decoder of this app, unique per pipeline.
+ */
+static gchar *
+app_model_name (AppData *app, const gchar *name)
 {
-  GstElement *tee_source, *tee_cropinfo, *tee_cropped_video;
-  GstPad *landmark_overray_srcpad;
+  return g_strconcat (name, app->name_suffix, NULL);
+}
 
-  app->pipeline = gst_pipeline_new ("facemesh-pipeline");
-  if (!app->pipeline) {
-    g_printerr ("pipeline could not be created.\n");
-    return FALSE;
-  }
+/**
+ * @brief Link the src pad of an element to a sink pad.
+ */
+static gboolean
+link_to_pad (GstElement *src, GstPad *sink_pad)
+{
+  GstPad *src_pad = gst_element_get_static_pad (src, "src");
+  gboolean ret = (gst_pad_link (src_pad, sink_pad) == GST_PAD_LINK_OK);
 
-#define make_element_and_check(elem,factoryname,name) \
-  do { \
-    (elem) = gst_element_factory_make ((factoryname), (name)); \
-    if (!(elem)) { \
-      g_printerr ("%s could not be created.\n", (name)); \
-      gst_object_unref (app->pipeline); \
-      return FALSE; \
-    } \
-  } while (0)
+  gst_object_unref (src_pad);
+  return ret;
+}
 
-  /* Souece video */
-  {
-    GstElement *video_source, *convert, *filter, *crop, *scale;
-    GstCaps *video_caps;
+/**
+ * @brief Parse crop info (x, y, w, h and the optional rotation) from static or flexible tensor data.
+ */
+static gboolean
+parse_crop_info (const guint8 *data, gsize size, guint crop[4], gfloat *angle)
+{
+  GstTensorMetaInfo meta;
+  gsize hsize = 0;
 
-    make_element_and_check (video_source, "v4l2src", "video_source");
-    make_element_and_check (convert, "videoconvert", "convert_source");
-    make_element_and_check (filter, "capsfilter", "filter1");
-    make_element_and_check (crop, "aspectratiocrop", "crop_source");
-    make_element_and_check (scale, "videoscale", "scale_source");
-    make_element_and_check (tee_source, "tee", "tee_source");
+  if (gst_tensor_meta_info_parse_header (&meta, (gpointer) data))
+    hsize = gst_tensor_meta_info_get_header_size (&meta);
 
-    g_object_set (crop, "aspect-ratio", 1, 1, NULL);
+  if (size < hsize + 4 * sizeof (guint))
+    return FALSE;
 
-    video_caps = gst_caps_new_simple ("video/x-raw",
-       "format", G_TYPE_STRING, "RGB",
-       "width", G_TYPE_INT, app->video_size,
-       "height", G_TYPE_INT, app->video_size,
-       NULL);
-    g_object_set (G_OBJECT (filter), "caps", video_caps, NULL);
-    gst_caps_unref (video_caps);
+  memcpy (crop, data + hsize, 4 * sizeof (guint));
+  *angle = 0.0f;
+  if (size >= hsize + 5 * sizeof (guint))
+    *angle = ((const gint32 *) (data + hsize))[4] / CROP_INFO_ANGLE_SCALE;
 
-    gst_bin_add_many (GST_BIN (app->pipeline), video_source, convert, crop, scale, filter, tee_source, NULL);
-    if (!gst_element_link_many (video_source, convert, crop, scale, filter, tee_source, NULL)) {
-      g_printerr ("[SOURCE] Elements could not be linked.\n");
-      gst_object_unref (app->pipeline);
-      return FALSE;
-    }
+  return TRUE;
+}
 
-  }
+/**
+ * @brief Read crop info from a static or flexible tensor buffer.
+ */
+static gboolean
+read_crop_info (GstBuffer *buffer, guint crop[4], gfloat *angle)
+{
+  GstMemory *mem;
+  GstMapInfo map;
+  gboolean ret;
 
-  /* Face detection to crop info */
-  {
-    GstElement *queue;
-    GstElement *scale, *filter, *tconv, *ttransform, *tfilter_detect, *tfilter_cropinfo;
-    GstCaps *scale_caps;
-    BlazeFaceInfo *info;
+  mem = gst_buffer_peek_memory (buffer, 0);
+  if (!gst_memory_map (mem, &map, GST_MAP_READ))
+    return FALSE;
 
-    info = &app->detect_model;
+  ret = parse_crop_info (map.data, map.size, crop, angle);
 
-    make_element_and_check (queue, "queue", "queue_detect");
-    make_element_and_check (scale, "videoscale", "scale_detect");
-    make_element_and_check (filter, "capsfilter", "filter_detect");
-    make_element_and_check (tconv, "tensor_converter", "tconv_detect");
-    make_element_and_check (ttransform, "tensor_transform", "ttransform_detect");
-    make_element_and_check (tfilter_detect, "tensor_filter", "tfilter_detect");
-    make_element_and_check (tfilter_cropinfo, "tensor_filter", "filter_cropinfo");
-    make_element_and_check (tee_cropinfo, "tee", "tee_cropinfo");
+  gst_memory_unmap (mem, &map);
+  return ret;
+}
 
-    scale_caps = gst_caps_new_simple ("video/x-raw",
-       "format", G_TYPE_STRING, "RGB",
-       "framerate", GST_TYPE_FRACTION, 30, 1,
-       "width", G_TYPE_INT, info->tensor_width,
-       "height", G_TYPE_INT, info->tensor_height,
-       NULL);
-    g_object_set (G_OBJECT (filter), "caps", scale_caps, NULL);
-    gst_caps_unref (scale_caps);
+/**
+ * @brief Publish the result of a frame to the enabled result outputs.
+ */
+static void
+app_publish_result (AppData *app, GstClockTime pts, const guint crop[4], gfloat angle,
+    const gfloat *landmarks, gfloat score)
+{
+  LandmarkRingSlot *slot;
 
-    g_object_set (ttransform, "mode", 2 /* GTT_ARITHMETIC */, "option", "typecast:float32,add:-127.5,div:127.5", NULL);
-    g_object_set (tfilter_detect, "framework", "tensorflow-lite", "model", app->detect_model.model_path, NULL);
-    g_object_set (tfilter_cropinfo, "framework", "custom-easy", "model", "detection_to_cropinfo", NULL);
+  if (app->result_ring) {
+    slot = landmark_ring_begin_write (app->result_ring);
+    slot->pts = GST_CLOCK_TIME_IS_VALID (pts) ? pts : G_MAXUINT64;
+    slot->crop_x = crop[0];
+    slot->crop_y = crop[1];
+    slot->crop_w = crop[2];
+    slot->crop_h = crop[3];
+    slot->score = score;
+    slot->angle = angle;
+    memcpy (slot->landmarks, landmarks, sizeof (slot->landmarks));
+    landmark_ring_commit (app->result_ring);
+  }
 
-    gst_bin_add_many (GST_BIN (app->pipeline), 
-        queue, scale, filter, tconv, ttransform, tfilter_detect, tfilter_cropinfo, tee_cropinfo, NULL);
+  if (app->batch_file) {
+    LandmarkCrop c = { .angle = angle };
+    gfloat points[LANDMARK_INTERP_NUM_COORDS];
+    guint i;
 
-    if (!gst_element_link_many (queue, scale, filter, tconv, ttransform, tfilter_detect, tfilter_cropinfo, tee_cropinfo, NULL)) {
-      g_printerr ("[DETECT] Elements could not be linked.\n");
-      gst_object_unref (app->pipeline);
-      return FALSE;
-    }
+    /* the ring and the archive keep the crop, the CSV is read without it */
+    memcpy (c.crop, crop, sizeof (c.crop));
+    c.tensor_width = app->landmark_model.tensor_width;
+    c.tensor_height = app->landmark_model.tensor_height;
+    landmark_interp_to_frame (&c, landmarks, points);
 
-    if (!request_tee_and_link (tee_source, queue, "sink")) {
-      gst_object_unref (app->pipeline);
-      return FALSE;
-    }
+    fprintf (app->batch_file, "%" G_GUINT64_FORMAT ",%u,%u,%u,%u,%.6f,%.6f",
+        GST_CLOCK_TIME_IS_VALID (pts) ? pts : G_MAXUINT64,
+        crop[0], crop[1], crop[2], crop[3], angle, score);
+    for (i = 0; i < LANDMARK_INTERP_NUM_COORDS; i++)
+      fprintf (app->batch_file, ",%.3f", points[i]);
+    fputc ('\n', app->batch_file);
   }
 
-  /* Crop video */
-  {
-    GstElement *queue_cropinfo, *queue, *tconv_src, *tcrop, *tdec_flexible, *tconv;
-    gchar *input_dim;
+  if (app->archive && landmark_archive_append (app->archive,
+          GST_CLOCK_TIME_IS_VALID (pts) ? pts : G_MAXUINT64, crop, angle, score, landmarks) < 0) {
+    /* the chunks written so far stay readable, the reader rebuilds the index */
+    g_printerr ("landmark archive write failed, archiving stopped.\n");
+    landmark_archive_finish (app->archive);
+    app->archive = NULL;
+  }
 
-    make_element_and_check (queue_cropinfo, "queue", "queue_cropinfo1");
-    make_element_and_check (queue, "queue", "queue_cropsrc");
-    make_element_and_check (tconv_src, "tensor_converter", "tconv_cropsrc");
-    make_element_and_check (tcrop, "tensor_crop", "tcrop");
-    make_element_and_check (tdec_flexible, "tensor_decoder", "tdec_flexible");
-    make_element_and_check (tconv, "tensor_converter", "tconv_crop");
-    make_element_and_check (tee_cropped_video, "tee", "tee_cropped_video");
+  if (app->batch_uri)
+    app->batch_frames++;
+}
 
-    g_object_set (tdec_flexible, "mode", "custom-code", "option1", "flexible_tensor_scale", NULL);
-    input_dim = g_strdup_printf ("3:%d:%d", app->landmark_model.tensor_width, app->landmark_model.tensor_height);
-    g_object_set (tconv, "input-type", "uint8", "input-dim", input_dim, NULL);
-    g_free (input_dim);
+/**
+ * @brief Keep the crop info of a frame until its landmark result arrives.
+ */
+static void
+crop_history_add (AppData *app, GstBuffer *buffer)
+{
+  CropInfoRecord *record;
+  guint crop[4];
+  gfloat angle;
 
-    gst_bin_add_many (GST_BIN (app->pipeline),
-        queue_cropinfo, queue, tconv_src, tcrop, tdec_flexible, tconv, tee_cropped_video, NULL);
+  if (!read_crop_info (buffer, crop, &angle))
+    return;
 
-    if (!gst_element_link_many (queue, tconv_src, NULL)
-        || !gst_element_link_pads (tconv_src, "src", tcrop, "raw")
-        || !gst_element_link_pads (queue_cropinfo, "src", tcrop, "info")
-        || !gst_element_link_many (tcrop, tdec_flexible, tconv, tee_cropped_video, NULL)
-    ) {
-      g_printerr ("[CROP] Elements could not be linked.\n");
-      gst_object_unref (app->pipeline);
-      return FALSE;
-    }
+  g_mutex_lock (&app->result_lock);
+  record = &app->crop_history[app->crop_history_idx];
+  record->pts = GST_BUFFER_PTS (buffer);
+  memcpy (record->crop, crop, sizeof (crop));
+  record->angle = angle;
+  app->crop_history_idx = (app->crop_history_idx + 1) % CROP_HISTORY_SIZE;
+  g_mutex_unlock (&app->result_lock);
+}
 
-    if (!request_tee_and_link (tee_source, queue, "sink")
-        || !request_tee_and_link (tee_cropinfo, queue_cropinfo, "sink")) {
-      gst_object_unref (app->pipeline);
-      return FALSE;
+/**
+ * @brief Find the crop info of a frame.
+ * @return FALSE if it is not in the history.
+ */
+static gboolean
+crop_history_find (AppData *app, GstClockTime pts, guint crop[4], gfloat *angle)
+{
+  gboolean found = FALSE;
+  guint i;
+
+  g_mutex_lock (&app->result_lock);
+  for (i = 0; i < CROP_HISTORY_SIZE; i++) {
+    if (app->crop_history[i].pts == pts) {
+      memcpy (crop, app->crop_history[i].crop, 4 * sizeof (guint));
+      *angle = app->crop_history[i].angle;
+      found = TRUE;
+      break;
     }
   }
+  g_mutex_unlock (&app->result_lock);
 
-  /* Cropped video to videosink */
-  {
-    GstElement *queue, *tdec_video, *convert, *video_sink;
+  return found;
+}
 
-    make_element_and_check (queue, "queue", "queue_cropped_video");
-    make_element_and_check (tdec_video, "tensor_decoder", "tdec_video");
-    make_element_and_check (convert, "videoconvert", "convert_crop");
-    make_element_and_check (video_sink, "autovideosink", "video_sink_crop");
+/**
+ * @brief Callback of tensor_sink, keeps the crop info until its landmark result arrives.
+ */
+static void
+cropinfo_sink_new_data_cb (GstElement *sink, GstBuffer *buffer, AppData *app)
+{
+  /* recorded earlier by landmark_interp_cropinfo_probe_cb */
+  if (app->landmark_interval > 1)
+    return;
 
-    g_object_set (tdec_video, "mode", "direct_video", NULL);
+  crop_history_add (app, buffer);
+}
+
+/**
+ * @brief Callback of tensor_sink, pairs the landmark result with its crop info and publishes it.
+ *
+ * A result without crop info cannot be mapped to the frame, it is counted
+ * and not published.
+ */
+static void
+landmark_sink_new_data_cb (GstElement *sink, GstBuffer *buffer, AppData *app)
+{
+  GstMemory *mem_landmark, *mem_score;
+  GstMapInfo map_landmark, map_score;
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  guint crop[4];
+  gfloat angle;
+  gfloat score;
+
+  if (gst_buffer_n_memory (buffer) < 2)
+    return;
+
+  if (!crop_history_find (app, pts, crop, &angle)) {
+    app->crop_history_misses++;
+    return;
+  }
+
+  mem_landmark = gst_buffer_peek_memory (buffer, 0);
+  mem_score = gst_buffer_peek_memory (buffer, 1);
+  if (!gst_memory_map (mem_landmark, &map_landmark, GST_MAP_READ))
+    return;
+  if (!gst_memory_map (mem_score, &map_score, GST_MAP_READ)) {
+    gst_memory_unmap (mem_landmark, &map_landmark);
+    return;
+  }
+
+  if (map_landmark.size >= LANDMARK_RING_NUM_COORDS * sizeof (gfloat)
+      && map_score.size >= sizeof (gfloat)) {
+    score = sigmoid (*(gfloat *) map_score.data);
+    app_publish_result (app, pts, crop, angle, (const gfloat *) map_landmark.data, score);
+  }
+
+  gst_memory_unmap (mem_score, &map_score);
+  gst_memory_unmap (mem_landmark, &map_landmark);
+}
+
+/**
+ * @brief Idle callback that releases the warm-up pipelines once the app pipeline runs.
+ */
+static gboolean
+release_warmup_cb (gpointer user_data)
+{
+  AppData *app = user_data;
+
+  model_warmup_release (&app->detect_warmup);
+  model_warmup_release (&app->landmark_warmup);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Pad probe that reports the time from startup to the first landmark result.
+ */
+static GstPadProbeReturn
+first_landmark_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AppData *app = user_data;
+
+  g_print ("time to first landmark: %.1f ms\n",
+      (g_get_monotonic_time () - app->start_time) / 1000.0);
+
+  if (app->warmup)
+    g_idle_add (release_warmup_cb, app);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/**
+ * @brief Pad probe on tee_cropped_video, numbers each frame and records its PTS for reordering.
+ */
+static GstPadProbeReturn
+landmark_dispatch_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AppData *app = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  guint tail;
+
+  g_mutex_lock (&app->reorder_lock);
+  if (app->reorder_expected_len == LANDMARK_REORDER_SIZE) {
+    /* not expected with the capped instance queues, the frames in flight are kept */
+    g_mutex_unlock (&app->reorder_lock);
+    return GST_PAD_PROBE_DROP;
+  }
+  app->landmark_dispatch_seq++;
+  tail = (app->reorder_expected_head + app->reorder_expected_len) % LANDMARK_REORDER_SIZE;
+  app->reorder_expected[tail].pts = GST_BUFFER_PTS (buffer);
+  app->reorder_expected[tail].seq = app->landmark_dispatch_seq - 1;
+  app->reorder_expected_len++;
+  g_mutex_unlock (&app->reorder_lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Pad probe on each landmark instance queue, passes only the frames dealt to it.
+ */
+static GstPadProbeReturn
+landmark_instance_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AppData *app = user_data;
+  guint instance = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (pad), "landmark-instance"));
+
+  /* runs in the tee thread right after landmark_dispatch_probe_cb */
+  if ((app->landmark_dispatch_seq - 1) % app->landmark_instances == instance)
+    return GST_PAD_PROBE_OK;
+
+  return GST_PAD_PROBE_DROP;
+}
+
+/**
+ * @brief Push the pending landmark results that are next in PTS order. Called with reorder_lock.
+ * @param flush give up the frames still missing, used at EOS
+ */
+static void
+landmark_reorder_push_ready (AppData *app, gboolean flush)
+{
+  guint i;
+
+  /* every pending result waits on an expected frame */
+  while (app->reorder_pending_len > 0 && app->reorder_expected_len > 0) {
+    LandmarkReorderFrame *head = &app->reorder_expected[app->reorder_expected_head];
+    LandmarkReorderEntry *entry = NULL;
+    gboolean lost;
+
+    for (i = 0; i < app->reorder_pending_len; i++) {
+      if (app->reorder_pending[i].pts == head->pts) {
+        entry = &app->reorder_pending[i];
+        break;
+      }
+    }
+
+    if (!entry) {
+      /**
+       * Each instance returns its frames in dispatch order. The next frame is
+       * still being processed, unless its own instance has already returned a
+       * later frame, which means it was dropped on the way.
+       */
+      lost = flush
+          || app->reorder_received[head->seq % app->landmark_instances] > head->seq + 1;
+      if (!lost)
+        break;
+
+      app->reorder_expected_head = (app->reorder_expected_head + 1) % LANDMARK_REORDER_SIZE;
+      app->reorder_expected_len--;
+      continue;
+    }
+
+    app->reorder_expected_head = (app->reorder_expected_head + 1) % LANDMARK_REORDER_SIZE;
+    app->reorder_expected_len--;
+
+    if (GST_CLOCK_TIME_IS_VALID (app->reorder_last_pts) && entry->pts <= app->reorder_last_pts) {
+      gst_buffer_unref (entry->buffer);
+    } else {
+      app->reorder_last_pts = entry->pts;
+      gst_app_src_push_buffer (GST_APP_SRC (app->landmark_reorder_src), entry->buffer);
+    }
+    *entry = app->reorder_pending[--app->reorder_pending_len];
+  }
+}
+
+/**
+ * @brief Callback of appsink of each landmark instance, puts the result back in PTS order.
+ */
+static GstFlowReturn
+landmark_reorder_sample_cb (GstElement *sink, AppData *app)
+{
+  GstSample *sample;
+  GstBuffer *buffer;
+  LandmarkReorderEntry *entry;
+  guint instance = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (sink), "landmark-instance"));
+  gboolean expected = FALSE;
+  guint i;
+
+  g_signal_emit_by_name (sink, "pull-sample", &sample);
+  if (!sample)
+    return GST_FLOW_EOS;
+
+  buffer = gst_sample_get_buffer (sample);
+
+  g_mutex_lock (&app->reorder_lock);
+  if (!app->reorder_caps_set) {
+    gst_app_src_set_caps (GST_APP_SRC (app->landmark_reorder_src), gst_sample_get_caps (sample));
+    app->reorder_caps_set = TRUE;
+  }
+
+  for (i = 0; i < app->reorder_expected_len; i++) {
+    LandmarkReorderFrame *frame =
+        &app->reorder_expected[(app->reorder_expected_head + i) % LANDMARK_REORDER_SIZE];
+
+    if (frame->pts == GST_BUFFER_PTS (buffer)) {
+      app->reorder_received[instance] = MAX (app->reorder_received[instance], frame->seq + 1);
+      expected = TRUE;
+      break;
+    }
+  }
+
+  /**
+   * A result which is not expected anymore was given up as lost, a later
+   * frame is already pushed. Pending results each wait on an expected
+   * frame, so the pending array cannot be full here.
+   */
+  if (expected && app->reorder_pending_len < LANDMARK_REORDER_SIZE) {
+    entry = &app->reorder_pending[app->reorder_pending_len++];
+    entry->pts = GST_BUFFER_PTS (buffer);
+    entry->buffer = gst_buffer_ref (buffer);
+
+    landmark_reorder_push_ready (app, FALSE);
+  }
+  g_mutex_unlock (&app->reorder_lock);
+
+  gst_sample_unref (sample);
+  return GST_FLOW_OK;
+}
+
+/**
+ * @brief Callback of appsink EOS, ends the reordered stream after the last instance.
+ */
+static void
+landmark_reorder_eos_cb (GstElement *sink, AppData *app)
+{
+  g_mutex_lock (&app->reorder_lock);
+  if (++app->reorder_eos == app->landmark_instances) {
+    landmark_reorder_push_ready (app, TRUE);
+    gst_app_src_end_of_stream (GST_APP_SRC (app->landmark_reorder_src));
+  }
+  g_mutex_unlock (&app->reorder_lock);
+}
+
+/**
+ * @brief Pad probe on tee_cropinfo, records the crop of each frame before the frame is cropped.
+ */
+static GstPadProbeReturn
+landmark_interp_cropinfo_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  crop_history_add ((AppData *) user_data, GST_PAD_PROBE_INFO_BUFFER (info));
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Get the crop region of a frame for the landmark interpolation.
+ */
+static gboolean
+landmark_interp_get_crop (AppData *app, GstClockTime pts, LandmarkCrop *crop)
+{
+  crop->tensor_width = app->landmark_model.tensor_width;
+  crop->tensor_height = app->landmark_model.tensor_height;
+
+  return crop_history_find (app, pts, crop->crop, &crop->angle) && crop->crop[2] > 0
+      && crop->crop[3] > 0;
+}
+
+/**
+ * @brief Pad probe on the landmark queue, passes one frame out of landmark_interval to the model.
+ *
+ * The other frames get landmarks extrapolated from the last results and
+ * are dropped before the model. The model and landmark_interp_sample_cb run
+ * in this streaming thread, so the result of the previous frame is already
+ * known. A frame which cannot be extrapolated goes to the model. Under a
+ * latency budget, the adaptive controller thins out the landmark stage by
+ * widening the interval, every frame still gets landmarks.
+ */
+static GstPadProbeReturn
+landmark_interval_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AppData *app = user_data;
+  GstBuffer *frame = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime pts = GST_BUFFER_PTS (frame);
+  LandmarkCrop crop;
+  GstBuffer *buffer;
+  GstMemory *mem_landmark, *mem_score;
+  GstMapInfo map;
+  gfloat landmarks[LANDMARK_INTERP_NUM_COORDS];
+  gfloat score;
+  guint interval = app->landmark_interval
+      * MAX (g_atomic_int_get (&app->adapt.keep[ADAPT_STAGE_LANDMARK]), 1);
+
+  if (app->landmark_interval_seq++ % interval == 0
+      || !landmark_interp_get_crop (app, pts, &crop)
+      || !landmark_interp_predict (&app->landmark_interp, pts, &crop, landmarks, &score))
+    return GST_PAD_PROBE_OK;
+
+  /* same layout as the model output */
+  mem_landmark = gst_allocator_alloc (NULL, app->landmark_interp_sizes[0], NULL);
+  gst_memory_map (mem_landmark, &map, GST_MAP_WRITE);
+  memset (map.data, 0, map.size);
+  memcpy (map.data, landmarks, MIN (map.size, sizeof (landmarks)));
+  gst_memory_unmap (mem_landmark, &map);
+
+  mem_score = gst_allocator_alloc (NULL, app->landmark_interp_sizes[1], NULL);
+  gst_memory_map (mem_score, &map, GST_MAP_WRITE);
+  memset (map.data, 0, map.size);
+  memcpy (map.data, &score, MIN (map.size, sizeof (score)));
+  gst_memory_unmap (mem_score, &map);
+
+  buffer = gst_buffer_new ();
+  gst_buffer_append_memory (buffer, mem_landmark);
+  gst_buffer_append_memory (buffer, mem_score);
+  gst_buffer_copy_into (buffer, frame, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+
+  gst_app_src_push_buffer (GST_APP_SRC (app->landmark_interp_src), buffer);
+  app->landmark_extrapolated++;
+
+  return GST_PAD_PROBE_DROP;
+}
+
+/**
+ * @brief Callback of appsink after the landmark model, keeps the result as a keyframe and passes it on.
+ */
+static GstFlowReturn
+landmark_interp_sample_cb (GstElement *sink, AppData *app)
+{
+  GstSample *sample;
+  GstBuffer *buffer;
+  LandmarkCrop crop;
+
+  g_signal_emit_by_name (sink, "pull-sample", &sample);
+  if (!sample)
+    return GST_FLOW_EOS;
+
+  buffer = gst_sample_get_buffer (sample);
+  app->landmark_inferred++;
+
+  if (!app->landmark_interp_caps_set) {
+    gst_app_src_set_caps (GST_APP_SRC (app->landmark_interp_src), gst_sample_get_caps (sample));
+    app->landmark_interp_caps_set = TRUE;
+  }
+
+  if (gst_buffer_n_memory (buffer) >= 2
+      && landmark_interp_get_crop (app, GST_BUFFER_PTS (buffer), &crop)) {
+    GstMemory *mem_landmark = gst_buffer_peek_memory (buffer, 0);
+    GstMemory *mem_score = gst_buffer_peek_memory (buffer, 1);
+    GstMapInfo map_landmark, map_score;
+
+    if (gst_memory_map (mem_landmark, &map_landmark, GST_MAP_READ)) {
+      if (gst_memory_map (mem_score, &map_score, GST_MAP_READ)) {
+        if (map_landmark.size >= LANDMARK_INTERP_NUM_COORDS * sizeof (gfloat)
+            && map_score.size >= sizeof (gfloat)) {
+          landmark_interp_add_key (&app->landmark_interp, GST_BUFFER_PTS (buffer), &crop,
+              (const gfloat *) map_landmark.data, *(const gfloat *) map_score.data);
+          app->landmark_interp_sizes[0] = map_landmark.size;
+          app->landmark_interp_sizes[1] = map_score.size;
+        }
+        gst_memory_unmap (mem_score, &map_score);
+      }
+      gst_memory_unmap (mem_landmark, &map_landmark);
+    }
+  }
+
+  gst_app_src_push_buffer (GST_APP_SRC (app->landmark_interp_src), gst_buffer_ref (buffer));
+
+  gst_sample_unref (sample);
+  return GST_FLOW_OK;
+}
+
+/**
+ * @brief Callback of appsink EOS after the landmark model.
+ */
+static void
+landmark_interp_eos_cb (GstElement *sink, AppData *app)
+{
+  gst_app_src_end_of_stream (GST_APP_SRC (app->landmark_interp_src));
+}
+
+/**
+ * @brief Pad probe on the detector converter, records the PTS of the frames stacked into a batch.
+ */
+static GstPadProbeReturn
+detect_batch_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AppData *app = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  guint tail;
+
+  g_mutex_lock (&app->detect_batch_lock);
+  if (app->detect_batch_pts_len == DETECT_BATCH_PTS_SIZE) {
+    /* forget the oldest frame, its detection gets the next PTS */
+    app->detect_batch_pts_head = (app->detect_batch_pts_head + 1) % DETECT_BATCH_PTS_SIZE;
+    app->detect_batch_pts_len--;
+  }
+  tail = (app->detect_batch_pts_head + app->detect_batch_pts_len) % DETECT_BATCH_PTS_SIZE;
+  app->detect_batch_pts[tail] = GST_BUFFER_PTS (buffer);
+  app->detect_batch_pts_len++;
+  g_mutex_unlock (&app->detect_batch_lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Take the PTS of the oldest frame waiting for its detection.
+ * @return FALSE if no frame is waiting.
+ */
+static gboolean
+detect_batch_pop_pts (AppData *app, GstClockTime *pts)
+{
+  gboolean ret = FALSE;
+
+  g_mutex_lock (&app->detect_batch_lock);
+  if (app->detect_batch_pts_len > 0) {
+    *pts = app->detect_batch_pts[app->detect_batch_pts_head];
+    app->detect_batch_pts_head = (app->detect_batch_pts_head + 1) % DETECT_BATCH_PTS_SIZE;
+    app->detect_batch_pts_len--;
+    ret = TRUE;
+  }
+  g_mutex_unlock (&app->detect_batch_lock);
+
+  return ret;
+}
+
+/**
+ * @brief Callback of appsink after the batched detector, pushes the detection of each frame.
+ *
+ * The boxes and scores of a frame are contiguous in the batched output,
+ * so each frame gets shared sub-memories without copying.
+ */
+static GstFlowReturn
+detect_unbatch_sample_cb (GstElement *sink, AppData *app)
+{
+  GstSample *sample;
+  GstBuffer *buffer;
+  GstMemory *boxes, *scores;
+  gsize boxes_size = 16 * app->detect_model.num_boxes * sizeof (gfloat);
+  gsize scores_size = app->detect_model.num_boxes * sizeof (gfloat);
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i, frames;
+
+  g_signal_emit_by_name (sink, "pull-sample", &sample);
+  if (!sample)
+    return GST_FLOW_EOS;
+
+  buffer = gst_sample_get_buffer (sample);
+  if (gst_buffer_n_memory (buffer) != 2) {
+    g_critical ("batched detection has %u tensors, expected 2.", gst_buffer_n_memory (buffer));
+    gst_sample_unref (sample);
+    return GST_FLOW_ERROR;
+  }
+
+  boxes = gst_buffer_peek_memory (buffer, 0);
+  scores = gst_buffer_peek_memory (buffer, 1);
+  frames = MIN (boxes->size / boxes_size, scores->size / scores_size);
+
+  for (i = 0; i < frames && ret == GST_FLOW_OK; i++) {
+    GstBuffer *out = gst_buffer_new ();
+    GstClockTime pts = GST_CLOCK_TIME_NONE;
+
+    gst_buffer_append_memory (out, gst_memory_share (boxes, i * boxes_size, boxes_size));
+    gst_buffer_append_memory (out, gst_memory_share (scores, i * scores_size, scores_size));
+    detect_batch_pop_pts (app, &pts);
+    GST_BUFFER_PTS (out) = pts;
+
+    ret = gst_app_src_push_buffer (GST_APP_SRC (app->detect_unbatch_src), out);
+  }
+
+  gst_sample_unref (sample);
+  return ret;
+}
+
+/**
+ * @brief Callback of appsink EOS after the batched detector.
+ *
+ * The converter drops an incomplete batch at EOS. Those frames get an
+ * empty detection, so that every frame still has its crop info.
+ */
+static void
+detect_unbatch_eos_cb (GstElement *sink, AppData *app)
+{
+  gsize boxes_size = 16 * app->detect_model.num_boxes * sizeof (gfloat);
+  gsize scores_size = app->detect_model.num_boxes * sizeof (gfloat);
+  GstClockTime pts;
+
+  while (detect_batch_pop_pts (app, &pts)) {
+    GstBuffer *out = gst_buffer_new ();
+    GstMemory *scores = gst_allocator_alloc (NULL, scores_size, NULL);
+    GstMapInfo map;
+    guint i;
+
+    /* logit far below the score threshold */
+    gst_memory_map (scores, &map, GST_MAP_WRITE);
+    for (i = 0; i < app->detect_model.num_boxes; i++)
+      ((gfloat *) map.data)[i] = -100.0f;
+    gst_memory_unmap (scores, &map);
+
+    gst_buffer_append_memory (out, gst_allocator_alloc (NULL, boxes_size, NULL));
+    gst_buffer_append_memory (out, scores);
+    gst_buffer_memset (out, 0, 0, boxes_size);
+    GST_BUFFER_PTS (out) = pts;
+
+    if (gst_app_src_push_buffer (GST_APP_SRC (app->detect_unbatch_src), out) != GST_FLOW_OK)
+      break;
+  }
+
+  gst_app_src_end_of_stream (GST_APP_SRC (app->detect_unbatch_src));
+}
+
+/**
+ * @brief Callback of queue overrun signal.
+ */
+static void
+queue_overrun_cb (GstElement *queue, QueueStats *stats)
+{
+  g_atomic_int_inc (&stats->overruns);
+}
+
+/**
+ * @brief Callback of queue underrun signal.
+ */
+static void
+queue_underrun_cb (GstElement *queue, QueueStats *stats)
+{
+  g_atomic_int_inc (&stats->underruns);
+}
+
+/**
+ * @brief Find the branch a queue feeds from its name in build_pipeline.
+ */
+static QueueBranch
+queue_branch_of (GstElement *queue)
+{
+  const gchar *name = GST_ELEMENT_NAME (queue);
+
+  /* the result and display queues first, their names overlap the other branches */
+  if (g_str_has_suffix (name, "_result") || g_str_equal (name, "queue_cropinfo2")
+      || g_str_equal (name, "queue_cropped_video"))
+    return QUEUE_BRANCH_RESULT;
+  if (g_str_has_prefix (name, "queue_landmark"))
+    return QUEUE_BRANCH_LANDMARK;
+  if (g_str_has_prefix (name, "queue_crop"))
+    return QUEUE_BRANCH_CROP;
+
+  return QUEUE_BRANCH_DETECT;
+}
+
+/**
+ * @brief Get the name of a branch, as used in the reports and in the thread options.
+ */
+static const gchar *
+queue_branch_name (QueueBranch branch)
+{
+  static const gchar *names[QUEUE_BRANCH_NUM] = { "detect", "crop", "landmark", "result" };
+
+  return names[branch];
+}
+
+/**
+ * @brief Find the branch of a thread from the element that starts it.
+ */
+static guint
+thread_branch_of (GstElement *owner)
+{
+  GstElementFactory *factory = gst_element_get_factory (owner);
+  const gchar *name = GST_ELEMENT_NAME (owner);
+
+  if (factory && g_str_equal (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)), "queue"))
+    return queue_branch_of (owner);
+
+  /* appsrc elements re-push the results of a branch */
+  if (g_str_equal (name, "detect_unbatch_src"))
+    return QUEUE_BRANCH_DETECT;
+  if (g_str_equal (name, "landmark_reorder_src"))
+    return QUEUE_BRANCH_LANDMARK;
+
+  return THREAD_BRANCH_SOURCE;
+}
+
+/**
+ * @brief Parse a branch name of the thread options.
+ */
+static gboolean
+thread_branch_parse (const gchar *str, guint *branch)
+{
+  static const gchar *names[THREAD_BRANCH_NUM] = { "detect", "crop", "landmark", "result", "source" };
+  guint i;
+
+  for (i = 0; i < THREAD_BRANCH_NUM; i++) {
+    if (g_str_equal (str, names[i])) {
+      *branch = i;
+      return TRUE;
+    }
+  }
+
+  g_printerr ("unknown branch %s, expected detect, crop, landmark, result or source.\n", str);
+  return FALSE;
+}
+
+/**
+ * @brief Parse a CPU list such as "2-3,6".
+ */
+static gboolean
+thread_cpus_parse (const gchar *str, cpu_set_t *cpus)
+{
+  gchar **ranges = g_strsplit (str, ",", -1);
+  gboolean ret = TRUE;
+  guint i;
+
+  CPU_ZERO (cpus);
+  for (i = 0; ranges[i] && ret; i++) {
+    gchar *end;
+    guint64 first, last;
+
+    first = last = g_ascii_strtoull (ranges[i], &end, 10);
+    if (*end == '-')
+      last = g_ascii_strtoull (end + 1, &end, 10);
+
+    if (end == ranges[i] || *end != '\0' || last < first || last >= CPU_SETSIZE) {
+      g_printerr ("invalid CPU list %s.\n", str);
+      ret = FALSE;
+      break;
+    }
+    for (; first <= last; first++)
+      CPU_SET (first, cpus);
+  }
+
+  g_strfreev (ranges);
+  return ret;
+}
+
+/**
+ * @brief Parse a scheduling policy: nice:N, fifo:PRIO or rr:PRIO.
+ */
+static gboolean
+thread_sched_parse (const gchar *str, ThreadPolicy *policy)
+{
+  const gchar *value = strchr (str, ':');
+  gchar *end;
+
+  if (!value)
+    goto invalid;
+
+  if (g_str_has_prefix (str, "nice:"))
+    policy->policy = SCHED_OTHER;
+  else if (g_str_has_prefix (str, "fifo:"))
+    policy->policy = SCHED_FIFO;
+  else if (g_str_has_prefix (str, "rr:"))
+    policy->policy = SCHED_RR;
+  else
+    goto invalid;
+
+  policy->priority = (gint) g_ascii_strtoll (value + 1, &end, 10);
+  if (end == value + 1 || *end != '\0')
+    goto invalid;
+
+  policy->has_policy = TRUE;
+  return TRUE;
+
+invalid:
+  g_printerr ("invalid scheduling policy %s, expected nice:N, fifo:PRIO or rr:PRIO.\n", str);
+  return FALSE;
+}
+
+/**
+ * @brief Parse the BRANCH=VALUE entries of the thread options.
+ */
+static gboolean
+thread_policies_parse (AppData *app)
+{
+  gchar **entries[2] = { app->thread_affinity, app->thread_sched };
+  guint k, i;
+
+  for (k = 0; k < 2; k++) {
+    for (i = 0; entries[k] && entries[k][i]; i++) {
+      gchar **kv = g_strsplit (entries[k][i], "=", 2);
+      guint branch;
+      gboolean ok = (g_strv_length (kv) == 2) && thread_branch_parse (kv[0], &branch);
+
+      if (ok) {
+        ThreadPolicy *policy = &app->thread_policies[branch];
+
+        if (k == 0)
+          ok = policy->has_cpus = thread_cpus_parse (kv[1], &policy->cpus);
+        else
+          ok = thread_sched_parse (kv[1], policy);
+      } else {
+        g_printerr ("invalid thread option %s, expected BRANCH=VALUE.\n", entries[k][i]);
+      }
+
+      g_strfreev (kv);
+      if (!ok)
+        return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+ * @brief Bus sync handler, applies the thread policy of the branch when a streaming thread starts.
+ *
+ * Stream status messages are posted synchronously from the streaming
+ * thread itself, so the policy is applied to the calling thread. The
+ * worker threads of the interpreters are created with the interpreter on
+ * another thread, see thread_cpus_enter().
+ */
+static GstBusSyncReply
+thread_policy_sync_cb (GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+  AppData *app = user_data;
+  GstStreamStatusType type;
+  GstElement *owner;
+  ThreadPolicy *policy;
+  guint branch;
+
+  if (GST_MESSAGE_TYPE (msg) != GST_MESSAGE_STREAM_STATUS)
+    return GST_BUS_PASS;
+
+  gst_message_parse_stream_status (msg, &type, &owner);
+  if (type != GST_STREAM_STATUS_TYPE_ENTER)
+    return GST_BUS_PASS;
+
+  branch = thread_branch_of (owner);
+  policy = &app->thread_policies[branch];
+
+  if (policy->has_cpus && pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &policy->cpus) != 0)
+    g_printerr ("[THREAD] %s: cannot set the CPU affinity.\n", GST_ELEMENT_NAME (owner));
+
+  if (policy->has_policy) {
+    if (policy->policy == SCHED_OTHER) {
+      /* nice applies per thread on Linux */
+      if (setpriority (PRIO_PROCESS, syscall (SYS_gettid), policy->priority) != 0)
+        g_printerr ("[THREAD] %s: cannot set nice %d.\n", GST_ELEMENT_NAME (owner), policy->priority);
+    } else {
+      struct sched_param param = { .sched_priority = policy->priority };
+
+      if (pthread_setschedparam (pthread_self (), policy->policy, &param) != 0)
+        g_printerr ("[THREAD] %s: cannot set the realtime priority %d.\n",
+            GST_ELEMENT_NAME (owner), policy->priority);
+    }
+  }
+
+  _print_log ("thread of %s in branch %u", GST_ELEMENT_NAME (owner), branch);
+  return GST_BUS_PASS;
+}
+
+/**
+ * @brief Move the calling thread to the CPUs of a branch while it builds an interpreter.
+ *
+ * The worker threads of an interpreter, such as the XNNPACK thread pool,
+ * are created along with it and inherit the affinity of the thread that
+ * builds it: the application, warm-up or model swap thread, never the
+ * streaming thread.
+ *
+ * @param[out] saved affinity to give back to thread_cpus_leave()
+ * @return TRUE if the affinity was changed.
+ */
+static gboolean
+thread_cpus_enter (AppData *app, guint branch, cpu_set_t *saved)
+{
+  ThreadPolicy *policy = &app->thread_policies[branch];
+
+  if (!policy->has_cpus
+      || pthread_getaffinity_np (pthread_self (), sizeof (cpu_set_t), saved) != 0)
+    return FALSE;
+
+  if (pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &policy->cpus) != 0) {
+    g_printerr ("[THREAD] cannot set the CPU affinity of branch %u.\n", branch);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * @brief Give the calling thread back the affinity saved by thread_cpus_enter().
+ */
+static void
+thread_cpus_leave (gboolean entered, const cpu_set_t *saved)
+{
+  if (entered)
+    pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), saved);
+}
+
+/**
+ * @brief Start a tensor_filter of the pipeline on the CPUs of its branch.
+ */
+static void
+thread_start_filter (AppData *app, const gchar *name, guint branch)
+{
+  GstElement *tfilter = gst_bin_get_by_name (GST_BIN (app->pipeline), name);
+  cpu_set_t saved;
+  gboolean entered;
+
+  if (!tfilter)
+    return;
+
+  entered = thread_cpus_enter (app, branch, &saved);
+  gst_element_set_state (tfilter, GST_STATE_PAUSED);
+  thread_cpus_leave (entered, &saved);
+  gst_object_unref (tfilter);
+}
+
+/**
+ * @brief Set the pipeline to PLAYING, the inference filters first on the CPUs of their branch.
+ *
+ * A tensor_filter builds its interpreter when it starts. The pipeline goes
+ * to READY, each inference filter is started on its own, then the rest of
+ * the pipeline follows. The filters are already PAUSED by then and are not
+ * restarted.
+ */
+static void
+app_start_pipeline (AppData *app)
+{
+  if (app->thread_policies[QUEUE_BRANCH_DETECT].has_cpus
+      || app->thread_policies[QUEUE_BRANCH_LANDMARK].has_cpus) {
+    guint i;
+
+    gst_element_set_state (app->pipeline, GST_STATE_READY);
+    thread_start_filter (app, "tfilter_detect", QUEUE_BRANCH_DETECT);
+    for (i = 0; i < app->landmark_instances; i++) {
+      gchar *name = app->landmark_instances > 1 ?
+          g_strdup_printf ("tfilter_landmark_%u", i) : g_strdup ("tfilter_landmark");
+
+      thread_start_filter (app, name, QUEUE_BRANCH_LANDMARK);
+      g_free (name);
+    }
+  }
+
+  gst_element_set_state (app->pipeline, GST_STATE_PLAYING);
+}
+
+/**
+ * @brief Apply the pipeline profile to an element and collect queue statistics.
+ */
+static void
+apply_profile_to_element (AppData *app, GstElement *element)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *factory_name;
+
+  if (!factory)
+    return;
+  factory_name = gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory));
+
+  if (g_str_equal (factory_name, "queue")) {
+    QueueStats *stats = g_new0 (QueueStats, 1);
+
+    stats->queue = element;
+    stats->branch = queue_branch_of (element);
+    g_signal_connect (element, "overrun", (GCallback) queue_overrun_cb, stats);
+    g_signal_connect (element, "underrun", (GCallback) queue_underrun_cb, stats);
+    g_ptr_array_add (app->queue_stats, stats);
+
+    /* the async detector works on the freshest frame, the crop lag stays within the tracking margin */
+    if (app->async_detect && g_str_equal (GST_ELEMENT_NAME (element), "queue_detect"))
+      return;
+
+    if (app->profile == PIPELINE_PROFILE_REALTIME) {
+      g_object_set (element, "max-size-buffers", 1, "max-size-bytes", 0,
+          "max-size-time", (guint64) 0, "leaky", 2 /* downstream */, NULL);
+    } else if (app->profile == PIPELINE_PROFILE_THROUGHPUT) {
+      g_object_set (element, "max-size-buffers", THROUGHPUT_QUEUE_SIZE, "max-size-bytes", 0,
+          "max-size-time", (guint64) 0, "leaky", 0 /* no */, NULL);
+    } else if (app->profile == PIPELINE_PROFILE_BATCH) {
+      guint size = BATCH_QUEUE_SIZE;
+      gchar *name = gst_element_get_name (element);
+
+      /**
+       * The detector emits nothing until it has a whole batch, so the crop
+       * branch holds the frames of a batch waiting for their crop info.
+       * Otherwise tee_source blocks before the detector gets the batch.
+       */
+      if (app->detect_batch > 1
+          && (g_str_equal (name, "queue_cropsrc") || g_str_equal (name, "queue_cropinfo1")))
+        size += app->detect_batch;
+      g_free (name);
+
+      g_object_set (element, "max-size-buffers", size, "max-size-bytes", 0,
+          "max-size-time", (guint64) 0, "leaky", 0 /* no */, NULL);
+    }
+
+    /* the frames in flight in the landmark instances must fit the reorder stage */
+    if (app->landmark_instances > 1 && g_str_has_prefix (GST_ELEMENT_NAME (element), "queue_landmark_")) {
+      guint size;
+
+      g_object_get (element, "max-size-buffers", &size, NULL);
+      if (size == 0 || size > LANDMARK_INSTANCE_QUEUE_SIZE) {
+        g_object_set (element, "max-size-buffers", LANDMARK_INSTANCE_QUEUE_SIZE,
+            "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+      }
+    }
+    return;
+  }
+
+  /* frames are dropped from both inputs, pair them by timestamp */
+  if ((app->profile == PIPELINE_PROFILE_REALTIME || app->latency_budget > 0)
+      && (g_str_equal (factory_name, "tensor_crop") || g_str_equal (factory_name, "crop_scale"))) {
+    g_object_set (element, "lateness", REALTIME_LATENESS, NULL);
+  }
+
+  if (app->profile == PIPELINE_PROFILE_DEFAULT)
+    return;
+
+  if (GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK)
+      && g_object_class_find_property (G_OBJECT_GET_CLASS (element), "sync")) {
+    g_object_set (element, "sync", FALSE, NULL);
+  }
+
+  if (app->profile == PIPELINE_PROFILE_REALTIME
+      && g_object_class_find_property (G_OBJECT_GET_CLASS (element), "qos")) {
+    g_object_set (element, "qos", TRUE, NULL);
+  }
+}
+
+/**
+ * @brief Iterator callback, collects the elements of a bin.
+ */
+static void
+collect_element (const GValue *value, gpointer user_data)
+{
+  g_ptr_array_add (user_data, g_value_dup_object (value));
+}
+
+/**
+ * @brief Collect every element of a bin, recursively.
+ *
+ * A resync restarts the iteration, so the callers act on the elements only
+ * once the list is complete and never connect or probe anything twice.
+ */
+static GPtrArray *
+collect_bin_elements (GstBin *bin)
+{
+  GPtrArray *elements = g_ptr_array_new_with_free_func (gst_object_unref);
+  GstIterator *it;
+
+  it = gst_bin_iterate_recurse (bin);
+  while (gst_iterator_foreach (it, collect_element, elements) == GST_ITERATOR_RESYNC) {
+    g_ptr_array_set_size (elements, 0);
+    gst_iterator_resync (it);
+  }
+  gst_iterator_free (it);
+
+  return elements;
+}
+
+/**
+ * @brief Apply the pipeline profile to all elements in the pipeline.
+ */
+static void
+apply_pipeline_profile (AppData *app)
+{
+  GPtrArray *elements = collect_bin_elements (GST_BIN (app->pipeline));
+  guint i;
+
+  for (i = 0; i < elements->len; i++)
+    apply_profile_to_element (app, g_ptr_array_index (elements, i));
+  g_ptr_array_unref (elements);
+}
+
+/**
+ * @brief Print the number of overruns (drops, for leaky queues) and underruns of each queue.
+ */
+static void
+print_queue_stats (AppData *app)
+{
+  guint i;
+
+  for (i = 0; i < app->queue_stats->len; i++) {
+    QueueStats *stats = g_ptr_array_index (app->queue_stats, i);
+    gint leaky;
+
+    g_object_get (stats->queue, "leaky", &leaky, NULL);
+    g_print ("%-24s %-8s %8d %-8s %8d underruns\n", GST_ELEMENT_NAME (stats->queue),
+        queue_branch_name (stats->branch), g_atomic_int_get (&stats->overruns),
+        leaky ? "dropped" : "overruns", g_atomic_int_get (&stats->underruns));
+  }
+}
+
+/**
+ * @brief Print the rolling summary of the queue monitor and start a new window.
+ *
+ * A queue fills up when what runs behind it cannot keep up, so the branch
+ * with the fullest queues is the bottleneck. Overruns only break ties, for
+ * example between full 1-deep leaky queues.
+ */
+static void
+queue_monitor_report (AppData *app)
+{
+  gdouble fill[QUEUE_BRANCH_NUM] = { 0 };
+  gint overruns[QUEUE_BRANCH_NUM] = { 0 }, underruns[QUEUE_BRANCH_NUM] = { 0 };
+  guint64 level_time[QUEUE_BRANCH_NUM] = { 0 };
+  QueueBranch bottleneck = QUEUE_BRANCH_DETECT;
+  GString *line = g_string_new ("[queues]");
+  guint i;
+
+  for (i = 0; i < app->queue_stats->len; i++) {
+    QueueStats *stats = g_ptr_array_index (app->queue_stats, i);
+    gint o = g_atomic_int_get (&stats->overruns), u = g_atomic_int_get (&stats->underruns);
+
+    if (stats->samples > 0) {
+      fill[stats->branch] = MAX (fill[stats->branch], stats->fill_sum / stats->samples);
+      level_time[stats->branch] = MAX (level_time[stats->branch],
+          stats->level_time_sum / stats->samples);
+    }
+    overruns[stats->branch] += o - stats->window_overruns;
+    underruns[stats->branch] += u - stats->window_underruns;
+
+    stats->fill_sum = 0.0;
+    stats->level_time_sum = 0;
+    stats->samples = 0;
+    stats->window_overruns = o;
+    stats->window_underruns = u;
+  }
+
+  for (i = 0; i < QUEUE_BRANCH_NUM; i++) {
+    g_string_append_printf (line, " %s %.0f%% %.1f ms (%d over, %d under)",
+        queue_branch_name (i), fill[i] * 100.0, level_time[i] / 1000000.0, overruns[i], underruns[i]);
+    if (fill[i] > fill[bottleneck]
+        || (fill[i] == fill[bottleneck] && overruns[i] > overruns[bottleneck]))
+      bottleneck = i;
+  }
+
+  if (fill[bottleneck] > 0.0 || overruns[bottleneck] > 0)
+    g_string_append_printf (line, " -> bottleneck: %s", queue_branch_name (bottleneck));
+  g_print ("%s\n", line->str);
+  g_string_free (line, TRUE);
+}
+
+/**
+ * @brief Timer callback of the queue monitor, samples the level of every queue.
+ */
+static gboolean
+queue_monitor_sample_cb (gpointer user_data)
+{
+  AppData *app = user_data;
+  guint i;
+
+  for (i = 0; i < app->queue_stats->len; i++) {
+    QueueStats *stats = g_ptr_array_index (app->queue_stats, i);
+    guint level_buffers, max_buffers;
+    guint64 level_time, max_time;
+    gdouble fill = 0.0;
+
+    g_object_get (stats->queue, "current-level-buffers", &level_buffers,
+        "current-level-time", &level_time, "max-size-buffers", &max_buffers,
+        "max-size-time", &max_time, NULL);
+
+    if (max_buffers > 0)
+      fill = (gdouble) level_buffers / max_buffers;
+    if (max_time > 0)
+      fill = MAX (fill, (gdouble) level_time / max_time);
+
+    stats->fill_sum += fill;
+    stats->level_time_sum += level_time;
+    stats->samples++;
+  }
+
+  if (++app->queue_monitor_ticks * QUEUE_MONITOR_SAMPLE_MS >= (guint) app->queue_monitor * 1000) {
+    queue_monitor_report (app);
+    app->queue_monitor_ticks = 0;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Get the tensor_transform option that prepares uint8 pixels for the model input.
+ *
+ * The transform is placed after the last queue of a branch, right before
+ * the tensor_filter, so only uint8 pixels are queued between threads.
+ * @return the arithmetic option, NULL if the pixels are fed to the model as-is.
+ */
+static const gchar *
+model_input_transform_option (ModelInputType input_type)
+{
+  switch (input_type) {
+    case MODEL_INPUT_UINT8:
+      return NULL;
+    case MODEL_INPUT_INT8:
+      /* wraps around in uint8, same as subtracting 128 after the cast */
+      return "add:128,typecast:int8";
+    case MODEL_INPUT_FLOAT16:
+      /* normalized in float32, converted at the interpreter boundary */
+      return "typecast:float32,add:-127.5,div:127.5,typecast:float16";
+    default:
+      return "typecast:float32,add:-127.5,div:127.5";
+  }
+}
+
+/**
+ * @brief Link the decoded video pad of uridecodebin in batch mode.
+ */
+static void
+batch_pad_added_cb (GstElement *decodebin, GstPad *pad, GstElement *convert)
+{
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  const gchar *media;
+
+  if (!caps)
+    caps = gst_pad_query_caps (pad, NULL);
+  media = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+
+  /* audio and other streams are left unlinked */
+  if (g_str_has_prefix (media, "video/")) {
+    GstPad *sink_pad = gst_element_get_static_pad (convert, "sink");
+
+    if (!gst_pad_is_linked (sink_pad) && gst_pad_link (pad, sink_pad) != GST_PAD_LINK_OK)
+      g_printerr ("[BATCH] decoded video could not be linked.\n");
+    gst_object_unref (sink_pad);
+  }
+
+  gst_caps_unref (caps);
+}
+
+/**
+ * @brief Pad probe of the adaptive controller, keeps one frame out of N.
+ */
+static GstPadProbeReturn
+adapt_decimate_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AdaptProbe *probe = user_data;
+  guint keep = g_atomic_int_get (probe->keep);
+
+  if (keep <= 1)
+    return GST_PAD_PROBE_OK;
+
+  return (probe->count++ % keep == 0) ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+/**
+ * @brief Pad probe after landmark inference, records the latency of the frame.
+ */
+static GstPadProbeReturn
+adapt_latency_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AppData *app = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime now = gst_element_get_current_running_time (app->pipeline);
+
+  /* live sources timestamp frames in running time */
+  if (!GST_CLOCK_TIME_IS_VALID (now) || !GST_BUFFER_PTS_IS_VALID (buffer)
+      || now < GST_BUFFER_PTS (buffer))
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&app->adapt.lock);
+  app->adapt.latency_max = MAX (app->adapt.latency_max, now - GST_BUFFER_PTS (buffer));
+  app->adapt.latency_count++;
+  g_mutex_unlock (&app->adapt.lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Add a probe to a pad of an element, if the element exists.
+ */
+static void
+adapt_add_probe (AppData *app, const gchar *element_name, const gchar *pad_name,
+    GstPadProbeCallback callback, gpointer user_data, GDestroyNotify destroy)
+{
+  GstElement *element = gst_bin_get_by_name (GST_BIN (app->pipeline), element_name);
+  GstPad *pad;
+
+  if (!element) {
+    if (destroy)
+      destroy (user_data);
+    return;
+  }
+
+  pad = gst_element_get_static_pad (element, pad_name);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, callback, user_data, destroy);
+  gst_object_unref (pad);
+  gst_object_unref (element);
+}
+
+/**
+ * @brief Add a decimation probe of a stage.
+ */
+static void
+adapt_add_stage (AppData *app, const gchar *element_name, const gchar *pad_name, AdaptStage stage)
+{
+  AdaptProbe *probe = g_new0 (AdaptProbe, 1);
+
+  probe->keep = &app->adapt.keep[stage];
+  adapt_add_probe (app, element_name, pad_name, adapt_decimate_probe_cb, probe, g_free);
+}
+
+/**
+ * @brief Get the CPU time used by the process in microseconds.
+ */
+static gint64
+adapt_process_cpu_us (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Set the degradation level, the probes pick it up with the next frame.
+ */
+static void
+adapt_set_level (AppData *app, guint level, gdouble latency_ms, gdouble cpu)
+{
+  guint i;
+
+  if (level == app->adapt.level)
+    return;
+
+  g_print ("[adapt] latency %.1f ms, cpu %.0f%%: level %u -> %u (detect 1/%u, preview 1/%u, "
+      "landmark 1/%u, source 1/%u)\n", latency_ms, cpu * 100.0, app->adapt.level, level,
+      adapt_levels[level][ADAPT_STAGE_DETECT], adapt_levels[level][ADAPT_STAGE_PREVIEW],
+      adapt_levels[level][ADAPT_STAGE_LANDMARK], adapt_levels[level][ADAPT_STAGE_SOURCE]);
+
+  app->adapt.level = level;
+  for (i = 0; i < ADAPT_STAGE_NUM; i++)
+    g_atomic_int_set (&app->adapt.keep[i], adapt_levels[level][i]);
+}
+
+/**
+ * @brief Timer callback of the adaptive controller, runs once per second.
+ *
+ * The controller steps down one level as soon as the latency budget or the
+ * CPU budget is exceeded, and steps back up after some seconds of headroom.
+ */
+static gboolean
+adapt_tick_cb (gpointer user_data)
+{
+  AppData *app = user_data;
+  AdaptState *adapt = &app->adapt;
+  gint64 wall_us = g_get_monotonic_time ();
+  gint64 cpu_us = adapt_process_cpu_us ();
+  gdouble cpu, latency_ms;
+  GstClockTime latency;
+
+  g_mutex_lock (&adapt->lock);
+  latency = adapt->latency_count > 0 ? adapt->latency_max : 0;
+  adapt->latency_max = 0;
+  adapt->latency_count = 0;
+  g_mutex_unlock (&adapt->lock);
+
+  latency_ms = latency / (gdouble) GST_MSECOND;
+  cpu = (gdouble) (cpu_us - adapt->last_cpu_us) / MAX (wall_us - adapt->last_wall_us, 1) / adapt->cpus;
+  adapt->last_wall_us = wall_us;
+  adapt->last_cpu_us = cpu_us;
+
+  if (latency_ms > app->latency_budget || cpu > ADAPT_CPU_HIGH) {
+    adapt->calm = 0;
+    if (adapt->level + 1 < ADAPT_NUM_LEVELS)
+      adapt_set_level (app, adapt->level + 1, latency_ms, cpu);
+  } else if (latency_ms < app->latency_budget * ADAPT_LATENCY_HEADROOM && cpu < ADAPT_CPU_LOW) {
+    if (++adapt->calm >= ADAPT_CALM_SECONDS && adapt->level > 0) {
+      adapt->calm = 0;
+      adapt_set_level (app, adapt->level - 1, latency_ms, cpu);
+    }
+  } else {
+    adapt->calm = 0;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Start the adaptive controller on the built pipeline.
+ */
+static void
+adapt_start (AppData *app)
+{
+  AdaptState *adapt = &app->adapt;
+  guint i;
+
+  g_mutex_init (&adapt->lock);
+  adapt->cpus = model_bench_cpu_budget ();
+  for (i = 0; i < ADAPT_STAGE_NUM; i++)
+    adapt->keep[i] = 1;
+
+  adapt_add_stage (app, "queue_detect", "src", ADAPT_STAGE_DETECT);
+  adapt_add_stage (app, "compositor", "src", ADAPT_STAGE_PREVIEW);
+  adapt_add_stage (app, "queue_cropped_video", "src", ADAPT_STAGE_PREVIEW);
+  adapt_add_stage (app, "tee_source", "sink", ADAPT_STAGE_SOURCE);
+
+  for (i = 0; i < app->landmark_instances; i++) {
+    gchar *suffix = app->landmark_instances > 1 ? g_strdup_printf ("_%u", i) : g_strdup ("");
+    gchar *name_queue = g_strconcat ("queue_landmark", suffix, NULL);
+    gchar *name_filter = g_strconcat ("tfilter_landmark", suffix, NULL);
+
+    /* landmark_interval_probe_cb widens its interval instead, a dropped keyframe would leave a frame without landmarks */
+    if (app->landmark_interval <= 1)
+      adapt_add_stage (app, name_queue, "src", ADAPT_STAGE_LANDMARK);
+    adapt_add_probe (app, name_filter, "src", adapt_latency_probe_cb, app, NULL);
+    g_free (suffix);
+    g_free (name_queue);
+    g_free (name_filter);
+  }
+
+  adapt->last_wall_us = g_get_monotonic_time ();
+  adapt->last_cpu_us = adapt_process_cpu_us ();
+  adapt->source_id = g_timeout_add_seconds (1, adapt_tick_cb, app);
+}
+
+/**
+ * @brief Get the tensor type of the model input, after model_input_transform_option.
+ */
+static const gchar *
+model_input_tensor_type (ModelInputType input_type)
+{
+  switch (input_type) {
+    case MODEL_INPUT_UINT8:
+      return "uint8";
+    case MODEL_INPUT_INT8:
+      return "int8";
+    case MODEL_INPUT_FLOAT16:
+      return "float16";
+    default:
+      return "float32";
+  }
+}
+
+gboolean
+build_pipeline (AppData *app)
+{
+  GstElement *tee_source, *tee_cropinfo, *tee_cropped_video, *tee_landmark = NULL;
+  GstPad *landmark_overray_srcpad = NULL;
+  gchar *model_name;
+
+  app->pipeline = gst_pipeline_new ("facemesh-pipeline");
+  if (!app->pipeline) {
+    g_printerr ("pipeline could not be created.\n");
+    return FALSE;
+  }
+
+#define make_element_and_check(elem,factoryname,name) \
+  do { \
+    (elem) = gst_element_factory_make ((factoryname), (name)); \
+    if (!(elem)) { \
+      g_printerr ("%s could not be created.\n", (name)); \
+      g_clear_pointer (&app->pipeline, gst_object_unref); \
+      return FALSE; \
+    } \
+  } while (0)
+
+  /* Souece video */
+  {
+    GstElement *video_source, *convert, *filter, *crop = NULL, *scale = NULL, *capture_filter = NULL;
+    GstCaps *video_caps;
+    gboolean linked;
+
+    make_element_and_check (video_source, app->batch_uri ? "uridecodebin" : "v4l2src", "video_source");
+    make_element_and_check (convert, "videoconvert", "convert_source");
+    make_element_and_check (filter, "capsfilter", "filter1");
+    make_element_and_check (tee_source, "tee", "tee_source");
+
+    video_caps = gst_caps_new_simple ("video/x-raw",
+       "format", G_TYPE_STRING, "RGB",
+       "width", G_TYPE_INT, app->video_width,
+       "height", G_TYPE_INT, app->video_height,
+       NULL);
+    if (app->batch_uri)
+      gst_caps_set_simple (video_caps, "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+    g_object_set (G_OBJECT (filter), "caps", video_caps, NULL);
+    gst_caps_unref (video_caps);
+
+    gst_bin_add_many (GST_BIN (app->pipeline), video_source, convert, filter, tee_source, NULL);
+
+    if (app->batch_uri) {
+      /* decoded frames are scaled to the pipeline geometry, letterboxed if needed */
+      make_element_and_check (scale, "videoscale", "scale_source");
+      g_object_set (scale, "add-borders", TRUE, NULL);
+      g_object_set (video_source, "uri", app->batch_uri, NULL);
+      g_signal_connect (video_source, "pad-added", (GCallback) batch_pad_added_cb, convert);
+
+      gst_bin_add (GST_BIN (app->pipeline), scale);
+      if (app->capture_width > 0) {
+        linked = gst_element_link_many (convert, scale, filter, tee_source, NULL);
+      } else {
+        make_element_and_check (crop, "aspectratiocrop", "crop_source");
+        g_object_set (crop, "aspect-ratio", 1, 1, NULL);
+        gst_bin_add (GST_BIN (app->pipeline), crop);
+        linked = gst_element_link_many (convert, crop, scale, filter, tee_source, NULL);
+      }
+    } else if (app->capture_width > 0) {
+      /* frames keep the camera geometry, only the format is converted */
+      make_element_and_check (capture_filter, "capsfilter", "filter_capture");
+
+      video_caps = gst_caps_new_simple ("video/x-raw",
+         "width", G_TYPE_INT, app->capture_width,
+         "height", G_TYPE_INT, app->capture_height,
+         NULL);
+      if (app->capture_format)
+        gst_caps_set_simple (video_caps, "format", G_TYPE_STRING, app->capture_format, NULL);
+      g_object_set (G_OBJECT (capture_filter), "caps", video_caps, NULL);
+      gst_caps_unref (video_caps);
+
+      gst_bin_add (GST_BIN (app->pipeline), capture_filter);
+      linked = gst_element_link_many (video_source, capture_filter, convert, filter, tee_source, NULL);
+    } else {
+      make_element_and_check (crop, "aspectratiocrop", "crop_source");
+      make_element_and_check (scale, "videoscale", "scale_source");
+
+      g_object_set (crop, "aspect-ratio", 1, 1, NULL);
+
+      gst_bin_add_many (GST_BIN (app->pipeline), crop, scale, NULL);
+      linked = gst_element_link_many (video_source, convert, crop, scale, filter, tee_source, NULL);
+    }
+
+    if (!linked) {
+      g_printerr ("[SOURCE] Elements could not be linked.\n");
+      g_clear_pointer (&app->pipeline, gst_object_unref);
+      return FALSE;
+    }
+
+  }
+
+  /* Face detection to crop info */
+  {
+    GstElement *queue;
+    GstElement *scale = NULL, *filter = NULL, *tfilter_window = NULL;
+    GstElement *tconv, *ttransform = NULL, *tfilter_detect, *tfilter_cropinfo;
+    GstElement *detect_sink = NULL, *detect_out, *detect_in;
+    GstElement *batch_sink = NULL;
+    GstCaps *scale_caps;
+    GstPad *pad;
+    BlazeFaceInfo *info;
+    const gchar *transform_option;
+    gchar *custom;
+
+    info = &app->detect_model;
+    transform_option = model_input_transform_option (info->input_type);
+
+    make_element_and_check (queue, "queue", "queue_detect");
+    make_element_and_check (tconv, "tensor_converter", "tconv_detect");
+    if (app->search_window) {
+      /* the window is cropped and scaled from the full resolution frame */
+      make_element_and_check (tfilter_window, "tensor_filter", "tfilter_detect_window");
+      model_name = app_model_name (app, "detect_window");
+      g_object_set (tfilter_window, "framework", "custom-easy", "model", model_name, NULL);
+      g_free (model_name);
+    } else {
+      make_element_and_check (scale, "videoscale", "scale_detect");
+      make_element_and_check (filter, "capsfilter", "filter_detect");
+      g_object_set (scale, "add-borders", TRUE, NULL);
+    }
+    if (transform_option)
+      make_element_and_check (ttransform, "tensor_transform", "ttransform_detect");
+    make_element_and_check (tfilter_detect, "tensor_filter", "tfilter_detect");
+    if (app->detect_batch > 1) {
+      /* the detector output is split per frame and pushed to the crop info filter */
+      make_element_and_check (batch_sink, "appsink", "detect_batch_sink");
+      make_element_and_check (app->detect_unbatch_src, "appsrc", "detect_unbatch_src");
+    }
+    make_element_and_check (tfilter_cropinfo, "tensor_filter", "filter_cropinfo");
+    if (app->async_detect) {
+      /* crop info is taken from the latest detection in the crop branch */
+      make_element_and_check (detect_sink, "fakesink", "detect_sink");
+      g_object_set (detect_sink, "sync", FALSE, "async", FALSE, NULL);
+      /* the detector always works on the freshest frame */
+      g_object_set (queue, "max-size-buffers", 1, "leaky", 2 /* downstream */, NULL);
+    } else {
+      make_element_and_check (tee_cropinfo, "tee", "tee_cropinfo");
+    }
+
+    if (filter) {
+      /* non-square frames are letterboxed, see init_blazeface */
+      scale_caps = gst_caps_new_simple ("video/x-raw",
+         "format", G_TYPE_STRING, "RGB",
+         "framerate", GST_TYPE_FRACTION, 30, 1,
+         "width", G_TYPE_INT, info->tensor_width,
+         "height", G_TYPE_INT, info->tensor_height,
+         "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+         NULL);
+      g_object_set (G_OBJECT (filter), "caps", scale_caps, NULL);
+      gst_caps_unref (scale_caps);
+    }
+
+    g_object_set (tfilter_detect, "framework", "tensorflow-lite", "model", app->detect_model.model_path, NULL);
+    custom = inference_options_to_custom (&app->detect_inference);
+    if (custom)
+      g_object_set (tfilter_detect, "custom", custom, NULL);
+    g_free (custom);
+    if (app->warmup)
+      g_object_set (tfilter_detect, "shared-tensor-filter-key", app->detect_warmup.shared_key, NULL);
+    /* the model may be reloaded at runtime, see model_swap_thread */
+    if (!app->batch_uri)
+      g_object_set (tfilter_detect, "is-updatable", TRUE, NULL);
+
+    if (batch_sink) {
+      gchar *dim;
+
+      /* B frames are stacked on the outermost dimension and the interpreter input is resized */
+      g_object_set (tconv, "frames-per-tensor", app->detect_batch, NULL);
+      dim = g_strdup_printf ("3:%u:%u:%u", info->tensor_width, info->tensor_height, app->detect_batch);
+      g_object_set (tfilter_detect, "input", dim,
+          "inputtype", model_input_tensor_type (info->input_type), NULL);
+      g_free (dim);
+
+      g_object_set (batch_sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+      g_signal_connect (batch_sink, "new-sample", (GCallback) detect_unbatch_sample_cb, app);
+      g_signal_connect (batch_sink, "eos", (GCallback) detect_unbatch_eos_cb, app);
+
+      /* same tensors as the detector output of a single frame */
+      scale_caps = gst_caps_new_simple ("other/tensors",
+          "num_tensors", G_TYPE_INT, 2,
+          "format", G_TYPE_STRING, "static",
+          "types", G_TYPE_STRING, "float32,float32",
+          NULL);
+      dim = g_strdup_printf ("16:%u:1,1:%u:1", info->num_boxes, info->num_boxes);
+      gst_caps_set_simple (scale_caps, "dimensions", G_TYPE_STRING, dim,
+          "framerate", GST_TYPE_FRACTION, 0, 1, NULL);
+      g_free (dim);
+      g_object_set (app->detect_unbatch_src, "format", GST_FORMAT_TIME, "block", TRUE,
+          "caps", scale_caps, NULL);
+      gst_caps_unref (scale_caps);
+
+      gst_bin_add_many (GST_BIN (app->pipeline), batch_sink, app->detect_unbatch_src, NULL);
+
+      pad = gst_element_get_static_pad (tconv, "sink");
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, detect_batch_probe_cb, app, NULL);
+      gst_object_unref (pad);
+    }
+
+    model_name = app_model_name (app, "detection_to_cropinfo");
+    g_object_set (tfilter_cropinfo, "framework", "custom-easy", "model", model_name, NULL);
+    g_free (model_name);
+    app->detect_stats_element = tfilter_cropinfo;
+
+    detect_out = app->async_detect ? detect_sink : tee_cropinfo;
+    gst_bin_add_many (GST_BIN (app->pipeline), 
+        queue, tconv, tfilter_detect, tfilter_cropinfo, detect_out, NULL);
+
+    if (ttransform) {
+      g_object_set (ttransform, "mode", 2 /* GTT_ARITHMETIC */, "option", transform_option, NULL);
+      gst_bin_add (GST_BIN (app->pipeline), ttransform);
+    }
+
+    if (tfilter_window) {
+      gst_bin_add (GST_BIN (app->pipeline), tfilter_window);
+      detect_in = tfilter_window;
+    } else {
+      gst_bin_add_many (GST_BIN (app->pipeline), scale, filter, NULL);
+      detect_in = tconv;
+    }
+
+    if (!(tfilter_window ? gst_element_link_many (queue, tconv, tfilter_window, NULL)
+            : gst_element_link_many (queue, scale, filter, tconv, NULL))
+        || !(ttransform ? gst_element_link_many (detect_in, ttransform, tfilter_detect, NULL)
+            : gst_element_link (detect_in, tfilter_detect))
+        || !(batch_sink ? gst_element_link (tfilter_detect, batch_sink)
+            && gst_element_link_many (app->detect_unbatch_src, tfilter_cropinfo, detect_out, NULL)
+            : gst_element_link_many (tfilter_detect, tfilter_cropinfo, detect_out, NULL))) {
+      g_printerr ("[DETECT] Elements could not be linked.\n");
+      g_clear_pointer (&app->pipeline, gst_object_unref);
+      return FALSE;
+    }
+
+    if (!request_tee_and_link (tee_source, queue, "sink")) {
+      g_clear_pointer (&app->pipeline, gst_object_unref);
+      return FALSE;
+    }
+  }
+
+  /* Crop video */
+  {
+    GstElement *queue_cropinfo, *queue, *tconv_src, *raw_out;
+    GstElement *tee_cropsrc, *queue_raw, *tfilter_latest;
+    GstPad *crop_raw_pad, *crop_info_pad;
+
+    make_element_and_check (queue_cropinfo, "queue", "queue_cropinfo1");
+    make_element_and_check (queue, "queue", "queue_cropsrc");
+    make_element_and_check (tconv_src, "tensor_converter", "tconv_cropsrc");
+    make_element_and_check (tee_cropped_video, "tee", "tee_cropped_video");
+
+    gst_bin_add_many (GST_BIN (app->pipeline), queue_cropinfo, queue, tconv_src, tee_cropped_video, NULL);
+
+    if (app->rotate_crop) {
+      GstElement *tmux, *tfilter_warp;
+
+      /* frame and crop info are paired by tensor_mux and warped to the landmark input at once */
+      make_element_and_check (tmux, "tensor_mux", "tmux_crop");
+      make_element_and_check (tfilter_warp, "tensor_filter", "tfilter_affine_crop");
+
+      model_name = app_model_name (app, "affine_crop");
+      g_object_set (tfilter_warp, "framework", "custom-easy", "model", model_name, NULL);
+      g_free (model_name);
+
+      gst_bin_add_many (GST_BIN (app->pipeline), tmux, tfilter_warp, NULL);
+
+      if (!gst_element_link_many (tmux, tfilter_warp, tee_cropped_video, NULL)) {
+        g_printerr ("[CROP] Elements could not be linked.\n");
+        g_clear_pointer (&app->pipeline, gst_object_unref);
+        return FALSE;
+      }
+
+      /* the frame must be the first tensor */
+      crop_raw_pad = gst_element_request_pad_simple (tmux, "sink_%u");
+      crop_info_pad = gst_element_request_pad_simple (tmux, "sink_%u");
+    } else {
+      GstElement *tcrop, *tdec_flexible, *tconv;
+      gchar *input_dim;
+
+      make_element_and_check (tcrop, "tensor_crop", "tcrop");
+      make_element_and_check (tdec_flexible, "tensor_decoder", "tdec_flexible");
+      make_element_and_check (tconv, "tensor_converter", "tconv_crop");
+
+      model_name = app_model_name (app, "flexible_tensor_scale");
+      g_object_set (tdec_flexible, "mode", "custom-code", "option1", model_name, NULL);
+      g_free (model_name);
+      input_dim = g_strdup_printf ("3:%d:%d", app->landmark_model.tensor_width, app->landmark_model.tensor_height);
+      g_object_set (tconv, "input-type", "uint8", "input-dim", input_dim, NULL);
+      g_free (input_dim);
+
+      gst_bin_add_many (GST_BIN (app->pipeline), tcrop, tdec_flexible, tconv, NULL);
+
+      if (!gst_element_link_many (tcrop, tdec_flexible, tconv, tee_cropped_video, NULL)) {
+        g_printerr ("[CROP] Elements could not be linked.\n");
+        g_clear_pointer (&app->pipeline, gst_object_unref);
+        return FALSE;
+      }
+
+      crop_raw_pad = gst_element_get_static_pad (tcrop, "raw");
+      crop_info_pad = gst_element_get_static_pad (tcrop, "info");
+    }
+
+    if (app->async_detect) {
+      /**
+       * Crop info of each frame comes from the latest finished detection,
+       * so cropping never waits for the detector of the same frame.
+       */
+      make_element_and_check (tee_cropsrc, "tee", "tee_cropsrc");
+      make_element_and_check (queue_raw, "queue", "queue_cropsrc_raw");
+      make_element_and_check (tfilter_latest, "tensor_filter", "filter_latest_cropinfo");
+      make_element_and_check (tee_cropinfo, "tee", "tee_cropinfo");
+
+      model_name = app_model_name (app, "latest_cropinfo");
+      g_object_set (tfilter_latest, "framework", "custom-easy", "model", model_name, NULL);
+      g_free (model_name);
+
+      gst_bin_add_many (GST_BIN (app->pipeline), tee_cropsrc, queue_raw, tfilter_latest, tee_cropinfo, NULL);
+
+      if (!gst_element_link (tconv_src, tee_cropsrc)
+          || !gst_element_link (tfilter_latest, tee_cropinfo)
+          || !request_tee_and_link (tee_cropsrc, queue_raw, "sink")
+          || !request_tee_and_link (tee_cropsrc, tfilter_latest, "sink")) {
+        g_printerr ("[CROP] Elements could not be linked.\n");
+        gst_object_unref (crop_raw_pad);
+        gst_object_unref (crop_info_pad);
+        g_clear_pointer (&app->pipeline, gst_object_unref);
+        return FALSE;
+      }
+      raw_out = queue_raw;
+    } else {
+      raw_out = tconv_src;
+    }
+
+    if (!gst_element_link (queue, tconv_src)
+        || !link_to_pad (raw_out, crop_raw_pad)
+        || !link_to_pad (queue_cropinfo, crop_info_pad)) {
+      g_printerr ("[CROP] Elements could not be linked.\n");
+      gst_object_unref (crop_raw_pad);
+      gst_object_unref (crop_info_pad);
+      g_clear_pointer (&app->pipeline, gst_object_unref);
+      return FALSE;
+    }
+    gst_object_unref (crop_raw_pad);
+    gst_object_unref (crop_info_pad);
+
+    if (!request_tee_and_link (tee_source, queue, "sink")
+        || !request_tee_and_link (tee_cropinfo, queue_cropinfo, "sink")) {
+      g_clear_pointer (&app->pipeline, gst_object_unref);
+      return FALSE;
+    }
+  }
+
+  /* Cropped video to videosink */
+  if (!app->batch_uri) {
+    GstElement *queue, *tdec_video, *convert, *video_sink;
+
+    make_element_and_check (queue, "queue", "queue_cropped_video");
+    make_element_and_check (tdec_video, "tensor_decoder", "tdec_video");
+    make_element_and_check (convert, "videoconvert", "convert_crop");
+    make_element_and_check (video_sink, "autovideosink", "video_sink_crop");
+
+    g_object_set (tdec_video, "mode", "direct_video", NULL);
 
     gst_bin_add_many (GST_BIN (app->pipeline), queue, tdec_video, convert, video_sink, NULL);
 
     if (!gst_element_link_many (queue, tdec_video, convert, video_sink, NULL)) {
       g_printerr ("[CROPPED VIDEO] Elements could not be linked.\n");
-      gst_object_unref (app->pipeline);
+      g_clear_pointer (&app->pipeline, gst_object_unref);
       return FALSE;
     }
 
     if (!request_tee_and_link (tee_cropped_video, queue, "sink")) {
-      gst_object_unref (app->pipeline);
+      g_clear_pointer (&app->pipeline, gst_object_unref);
       return FALSE;
     }
   }
 
   /* Face Landmark */
   {
-    GstElement *queue, *ttransform, *tfilter_landmark, *tdec_landmark;
+    GstElement *tdec_landmark = NULL, *landmark_out;
     LandmarkModelInfo *info;
     gchar *input_size, *output_size;
+    const gchar *transform_option;
+    gchar *custom;
+    GstPad *pad;
+    guint i;
 
     info = &app->landmark_model;
+    transform_option = model_input_transform_option (info->input_type);
+    custom = inference_options_to_custom (&app->landmark_inference);
 
-    make_element_and_check (queue, "queue", "queue_landmark");
-    make_element_and_check (ttransform, "tensor_transform", "ttransform_landmark");
-    make_element_and_check (tfilter_landmark, "tensor_filter", "tfilter_landmark");
-    make_element_and_check (tdec_landmark, "tensor_decoder", "tdec_landmark");
+    if (!app->batch_uri) {
+      /* landmark overlay of the result video */
+      make_element_and_check (tdec_landmark, "tensor_decoder", "tdec_landmark");
 
-    g_object_set (ttransform, "mode", 2 /* GTT_ARITHMETIC */, "option", "typecast:float32,add:-127.5,div:127.5", NULL);
-    g_object_set (tfilter_landmark, "framework", "tensorflow-lite", "model", app->landmark_model.model_path, NULL);
+      input_size = g_strdup_printf ("%d:%d", info->tensor_width, info->tensor_height);
+      output_size = g_strdup_printf ("%d:%d", app->video_width, app->video_height);
+      g_object_set (tdec_landmark, "mode", "face_landmark", "option1", "mediapipe-face-mesh", "option2", "0.9", "option3", output_size, "option4", input_size, NULL);
+      g_free (input_size);
+      g_free (output_size);
 
-    input_size = g_strdup_printf ("%d:%d", info->tensor_width, info->tensor_height);
-    output_size = g_strdup_printf ("%d:%d", app->video_size, app->video_size);
-    g_object_set (tdec_landmark, "mode", "face_landmark", "option1", "mediapipe-face-mesh", "option2", "0.9", "option3", output_size, "option4", input_size, NULL);
-    g_free (input_size);
-    g_free (output_size);
+      gst_bin_add (GST_BIN (app->pipeline), tdec_landmark);
+    }
 
-    gst_bin_add_many (GST_BIN (app->pipeline),
-        queue, ttransform, tfilter_landmark, tdec_landmark, NULL);
+    if (app->landmark_instances > 1) {
+      /**
+       * Frames are dealt round-robin to the interpreter instances, and the
+       * results are put back in PTS order before the decoder.
+       */
+      make_element_and_check (app->landmark_reorder_src, "appsrc", "landmark_reorder_src");
+      g_object_set (app->landmark_reorder_src, "format", GST_FORMAT_TIME, NULL);
+      gst_bin_add (GST_BIN (app->pipeline), app->landmark_reorder_src);
+      landmark_out = app->landmark_reorder_src;
 
-    if (!gst_element_link_many (queue, ttransform, tfilter_landmark, tdec_landmark, NULL))
-    {
+      pad = gst_element_get_static_pad (tee_cropped_video, "sink");
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, landmark_dispatch_probe_cb, app, NULL);
+      gst_object_unref (pad);
+    } else if (app->landmark_interval > 1) {
+      /**
+       * One frame out of N goes through the model, the landmarks of the
+       * others are extrapolated, and both are pushed in frame order.
+       */
+      make_element_and_check (app->landmark_interp_src, "appsrc", "landmark_interp_src");
+      g_object_set (app->landmark_interp_src, "format", GST_FORMAT_TIME, NULL);
+      gst_bin_add (GST_BIN (app->pipeline), app->landmark_interp_src);
+      landmark_out = app->landmark_interp_src;
+
+      /* the crop of a frame is needed before its landmarks, not when the result sink gets it */
+      pad = gst_element_get_static_pad (tee_cropinfo, "sink");
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, landmark_interp_cropinfo_probe_cb, app, NULL);
+      gst_object_unref (pad);
+    }
+
+    for (i = 0; i < app->landmark_instances; i++) {
+      GstElement *queue, *ttransform = NULL, *tfilter_landmark, *reorder_sink;
+      gchar *suffix, *name_queue, *name_transform, *name_filter, *name_sink;
+
+      suffix = app->landmark_instances > 1 ? g_strdup_printf ("_%u", i) : g_strdup ("");
+      name_queue = g_strconcat ("queue_landmark", suffix, NULL);
+      name_transform = g_strconcat ("ttransform_landmark", suffix, NULL);
+      name_filter = g_strconcat ("tfilter_landmark", suffix, NULL);
+      name_sink = g_strconcat ("landmark_reorder_sink", suffix, NULL);
+      g_free (suffix);
+
+      queue = gst_element_factory_make ("queue", name_queue);
+      if (transform_option)
+        ttransform = gst_element_factory_make ("tensor_transform", name_transform);
+      tfilter_landmark = gst_element_factory_make ("tensor_filter", name_filter);
+      reorder_sink = app->landmark_instances > 1 ?
+          gst_element_factory_make ("appsink", name_sink) : NULL;
+
+      if (!queue || (transform_option && !ttransform) || !tfilter_landmark
+          || (app->landmark_instances > 1 && !reorder_sink)) {
+        g_printerr ("%s could not be created.\n", name_filter);
+        g_free (name_queue);
+        g_free (name_transform);
+        g_free (name_filter);
+        g_free (name_sink);
+        g_free (custom);
+        g_clear_pointer (&app->pipeline, gst_object_unref);
+        return FALSE;
+      }
+
+      g_free (name_queue);
+      g_free (name_transform);
+      g_free (name_filter);
+      g_free (name_sink);
+
+      g_object_set (tfilter_landmark, "framework", "tensorflow-lite", "model", app->landmark_model.model_path, NULL);
+      if (custom)
+        g_object_set (tfilter_landmark, "custom", custom, NULL);
+      /* instances must not share one interpreter, only the first takes the warmed-up one */
+      if (app->warmup && i == 0)
+        g_object_set (tfilter_landmark, "shared-tensor-filter-key", app->landmark_warmup.shared_key, NULL);
+      if (!app->batch_uri)
+        g_object_set (tfilter_landmark, "is-updatable", TRUE, NULL);
+
+      gst_bin_add_many (GST_BIN (app->pipeline), queue, tfilter_landmark, NULL);
+
+      if (ttransform) {
+        g_object_set (ttransform, "mode", 2 /* GTT_ARITHMETIC */, "option", transform_option, NULL);
+        gst_bin_add (GST_BIN (app->pipeline), ttransform);
+      }
+
+      if (!(ttransform ? gst_element_link_many (queue, ttransform, tfilter_landmark, NULL)
+              : gst_element_link (queue, tfilter_landmark)))
+      {
+        g_printerr ("[LANDMARK] Elements could not be linked.\n");
+        g_free (custom);
+        g_clear_pointer (&app->pipeline, gst_object_unref);
+        return FALSE;
+      }
+
+      if (reorder_sink) {
+        g_object_set (reorder_sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+        g_object_set_data (G_OBJECT (reorder_sink), "landmark-instance", GUINT_TO_POINTER (i));
+        g_signal_connect (reorder_sink, "new-sample", (GCallback) landmark_reorder_sample_cb, app);
+        g_signal_connect (reorder_sink, "eos", (GCallback) landmark_reorder_eos_cb, app);
+        gst_bin_add (GST_BIN (app->pipeline), reorder_sink);
+
+        if (!gst_element_link (tfilter_landmark, reorder_sink)) {
+          g_printerr ("[LANDMARK] Elements could not be linked.\n");
+          g_free (custom);
+          g_clear_pointer (&app->pipeline, gst_object_unref);
+          return FALSE;
+        }
+
+        pad = gst_element_get_static_pad (queue, "sink");
+        g_object_set_data (G_OBJECT (pad), "landmark-instance", GUINT_TO_POINTER (i));
+        gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, landmark_instance_probe_cb, app, NULL);
+        gst_object_unref (pad);
+      } else if (app->landmark_interp_src) {
+        GstElement *interp_sink;
+
+        make_element_and_check (interp_sink, "appsink", "landmark_interp_sink");
+        g_object_set (interp_sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+        g_signal_connect (interp_sink, "new-sample", (GCallback) landmark_interp_sample_cb, app);
+        g_signal_connect (interp_sink, "eos", (GCallback) landmark_interp_eos_cb, app);
+        gst_bin_add (GST_BIN (app->pipeline), interp_sink);
+
+        if (!gst_element_link (tfilter_landmark, interp_sink)) {
+          g_printerr ("[LANDMARK] Elements could not be linked.\n");
+          g_free (custom);
+          g_clear_pointer (&app->pipeline, gst_object_unref);
+          return FALSE;
+        }
+
+        pad = gst_element_get_static_pad (queue, "src");
+        gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, landmark_interval_probe_cb, app, NULL);
+        gst_object_unref (pad);
+      } else {
+        landmark_out = tfilter_landmark;
+      }
+
+      if (!request_tee_and_link (tee_cropped_video, queue, "sink")) {
+        g_free (custom);
+        g_clear_pointer (&app->pipeline, gst_object_unref);
+        return FALSE;
+      }
+    }
+    g_free (custom);
+
+    if (app->result_ring || app->archive || app->batch_uri) {
+      /* landmark tensors are also delivered to the result sink */
+      make_element_and_check (tee_landmark, "tee", "tee_landmark");
+      gst_bin_add (GST_BIN (app->pipeline), tee_landmark);
+
+      if (!gst_element_link (landmark_out, tee_landmark)
+          || (tdec_landmark && !request_tee_and_link (tee_landmark, tdec_landmark, "sink"))) {
+        g_printerr ("[LANDMARK] Elements could not be linked.\n");
+        g_clear_pointer (&app->pipeline, gst_object_unref);
+        return FALSE;
+      }
+    } else if (!gst_element_link (landmark_out, tdec_landmark)) {
       g_printerr ("[LANDMARK] Elements could not be linked.\n");
-      gst_object_unref (app->pipeline);
+      g_clear_pointer (&app->pipeline, gst_object_unref);
       return FALSE;
     }
 
-    if (!request_tee_and_link (tee_cropped_video, queue, "sink")) {
-      gst_object_unref (app->pipeline);
+    if (tdec_landmark) {
+      landmark_overray_srcpad = gst_element_get_static_pad (tdec_landmark, "src");
+
+      pad = gst_element_get_static_pad (landmark_out, "src");
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, first_landmark_probe_cb, app, NULL);
+      gst_object_unref (pad);
+    }
+  }
+
+  /* Landmark result sink */
+  if (app->result_ring || app->archive || app->batch_uri) {
+    GstElement *queue, *queue_cropinfo, *landmark_sink, *cropinfo_sink;
+
+    make_element_and_check (queue, "queue", "queue_landmark_result");
+    make_element_and_check (queue_cropinfo, "queue", "queue_cropinfo_result");
+    make_element_and_check (landmark_sink, "tensor_sink", "landmark_sink");
+    make_element_and_check (cropinfo_sink, "tensor_sink", "cropinfo_sink");
+
+    /* never block the live pipeline on the result outputs, batch mode keeps every frame */
+    if (!app->batch_uri) {
+      g_object_set (queue, "leaky", 2 /* downstream */, NULL);
+      g_object_set (queue_cropinfo, "leaky", 2 /* downstream */, NULL);
+    }
+    g_object_set (landmark_sink, "sync", FALSE, "emit-signal", TRUE, NULL);
+    g_object_set (cropinfo_sink, "sync", FALSE, "emit-signal", TRUE, NULL);
+    g_signal_connect (landmark_sink, "new-data", (GCallback) landmark_sink_new_data_cb, app);
+    g_signal_connect (cropinfo_sink, "new-data", (GCallback) cropinfo_sink_new_data_cb, app);
+
+    gst_bin_add_many (GST_BIN (app->pipeline),
+        queue, queue_cropinfo, landmark_sink, cropinfo_sink, NULL);
+
+    if (!gst_element_link (queue, landmark_sink)
+        || !gst_element_link (queue_cropinfo, cropinfo_sink)) {
+      g_printerr ("[RESULT SINK] Elements could not be linked.\n");
+      g_clear_pointer (&app->pipeline, gst_object_unref);
       return FALSE;
     }
 
-    landmark_overray_srcpad = gst_element_get_static_pad (tdec_landmark, "src");
+    if (!request_tee_and_link (tee_landmark, queue, "sink")
+        || !request_tee_and_link (tee_cropinfo, queue_cropinfo, "sink")) {
+      g_clear_pointer (&app->pipeline, gst_object_unref);
+      return FALSE;
+    }
   }
 
   /* Result video */
-  {
+  if (!app->batch_uri) {
     GstElement *queue, *compositor, *convert, *video_sink, *queue_cropinfo, *crop_scale;
     GstPad *overray_raw_pad;
 
@@ -316,7 +2616,7 @@ build_pipeline (AppData *app)
         || !gst_element_link_pads (queue_cropinfo, "src", crop_scale, "info")
         || gst_pad_link (landmark_overray_srcpad, overray_raw_pad) != GST_PAD_LINK_OK) {
       g_printerr ("[RESULT] Elements could not be linked.\n");
-      gst_object_unref (app->pipeline);
+      g_clear_pointer (&app->pipeline, gst_object_unref);
       return FALSE;
     }
     gst_object_unref (overray_raw_pad);
@@ -325,34 +2625,184 @@ build_pipeline (AppData *app)
         || !request_compositor_and_link (crop_scale, "src", compositor, 2)
         || !request_tee_and_link (tee_source, queue, "sink")
         || !request_tee_and_link (tee_cropinfo, queue_cropinfo, "sink")) {
-      gst_object_unref (app->pipeline);
+      g_clear_pointer (&app->pipeline, gst_object_unref);
       return FALSE;
     }
 
   }
 
-  gst_object_unref (landmark_overray_srcpad);
+  if (landmark_overray_srcpad)
+    gst_object_unref (landmark_overray_srcpad);
+
+  apply_pipeline_profile (app);
+
+  if (app->queue_monitor > 0)
+    app->queue_monitor_id = g_timeout_add (QUEUE_MONITOR_SAMPLE_MS, queue_monitor_sample_cb, app);
+
+  if (app->latency_budget > 0)
+    adapt_start (app);
+
+  if (app->thread_affinity || app->thread_sched) {
+    GstBus *bus = gst_element_get_bus (app->pipeline);
+
+    gst_bus_set_sync_handler (bus, thread_policy_sync_cb, app, NULL);
+    gst_object_unref (bus);
+  }
+
+  if (app->trace_alloc) {
+    GPtrArray *elements = collect_bin_elements (GST_BIN (app->pipeline));
+
+    app->alloc_trace = alloc_trace_new ();
+    alloc_trace_attach (app->alloc_trace, elements);
+    g_ptr_array_unref (elements);
+  }
 
   GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN (app->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "pipeline");
   return TRUE;
 }
 
 static void
-margin_object(detectedObject *orig, detectedObject *margined, gfloat margin_rate, guint video_size)
+margin_object(detectedObject *orig, detectedObject *margined, gfloat margin_rate,
+    guint video_width, guint video_height)
 {
   gint height = orig->height;
   gint width = orig->width;
   gint orig_size = MAX(height, width);
   gint margin = orig_size * margin_rate;
-  gint margined_size = MIN(orig_size + margin * 2, video_size);
-  gint x = MIN(MAX(orig->x - margin, 0), video_size - margined_size);
-  gint y = MIN(MAX(orig->y - margin, 0), video_size - margined_size);
+  gint margined_size = MIN(orig_size + margin * 2, (gint) MIN(video_width, video_height));
+  gint x = MIN(MAX(orig->x - margin, 0), (gint) video_width - margined_size);
+  gint y = MIN(MAX(orig->y - margin, 0), (gint) video_height - margined_size);
   margined->x = x;
   margined->y = y;
   margined->width = margined_size;
   margined->height = margined_size;
 }
 
+/**
+ * @brief Snap a crop region to the bucket grid, with hysteresis.
+ *
+ * The size is rounded up to a multiple of the bucket step and the position
+ * to a quarter of it. The previous bucket is kept as long as it still
+ * covers the region and is at most one step too large, so the crop
+ * geometry stays the same across frames and downstream scale plans and
+ * buffers can be reused. The size grows by a step when the rounded
+ * position would cut the region.
+ */
+static void
+snap_crop_to_bucket (detectedObject *region, detectedObject *prev, guint step,
+    guint video_width, guint video_height)
+{
+  gint grid = MAX (step / 4, 1);
+  gint need = region->width;
+  gint max_size = MIN (video_width, video_height);
+  gint size = MIN ((need + step - 1) / step * step, max_size);
+  gint x, y;
+
+  if (prev->valid && prev->width >= need && prev->width <= size + (gint) step)
+    size = prev->width;
+
+  if (prev->valid && prev->width == size
+      && prev->x <= region->x && prev->x + size >= region->x + need
+      && prev->y <= region->y && prev->y + size >= region->y + need) {
+    x = prev->x;
+    y = prev->y;
+  } else {
+    for (;;) {
+      x = (region->x + need / 2 - size / 2 + grid / 2) / grid * grid;
+      y = (region->y + need / 2 - size / 2 + grid / 2) / grid * grid;
+      x = MIN (MAX (x, 0), (gint) video_width - size);
+      y = MIN (MAX (y, 0), (gint) video_height - size);
+
+      if (size >= max_size
+          || (x <= region->x && x + size >= region->x + need
+              && y <= region->y && y + size >= region->y + need))
+        break;
+      size = MIN (size + (gint) step, max_size);
+    }
+  }
+
+  region->x = x;
+  region->y = y;
+  region->width = size;
+  region->height = size;
+
+  *prev = *region;
+  prev->valid = TRUE;
+}
+
+/**
+ * @brief Update the nearest-neighbor index tables if the geometry changed.
+ * @param channels bytes per pixel
+ */
+static void
+scale_plan_update (ScalePlan *plan, guint in_width, guint in_height,
+    guint out_width, guint out_height, guint channels)
+{
+  guint i;
+
+  if (plan->x_offset && plan->in_width == in_width && plan->in_height == in_height
+      && plan->out_width == out_width && plan->out_height == out_height)
+    return;
+
+  g_free (plan->x_offset);
+  g_free (plan->y_offset);
+  plan->x_offset = g_new (guint, out_width);
+  plan->y_offset = g_new (guint, out_height);
+
+  for (i = 0; i < out_height; i++)
+    plan->y_offset[i] = channels * in_width * (guint) ((float) in_height / out_height * i);
+  for (i = 0; i < out_width; i++)
+    plan->x_offset[i] = channels * (guint) ((float) in_width / out_width * i);
+
+  plan->in_width = in_width;
+  plan->in_height = in_height;
+  plan->out_width = out_width;
+  plan->out_height = out_height;
+  plan->rebuilds++;
+}
+
+/**
+ * @brief Account the postprocess of a frame, and post the statistics as an element message when due.
+ */
+static void
+detect_stats_update (AppData *app, guint candidates, guint faces,
+    GstClockTime decode_time, GstClockTime nms_time)
+{
+  DetectStats *acc = &app->detect_stats_acc;
+  GstClockTime now = gst_util_get_timestamp ();
+  GstStructure *s;
+
+  if (acc->frames == 0)
+    acc->window_start = now;
+
+  acc->frames++;
+  acc->candidates += candidates;
+  acc->max_candidates = MAX (acc->max_candidates, candidates);
+  acc->faces += faces;
+  acc->decode_time += decode_time;
+  acc->max_decode_time = MAX (acc->max_decode_time, decode_time);
+  acc->nms_time += nms_time;
+  acc->max_nms_time = MAX (acc->max_nms_time, nms_time);
+
+  if (app->detect_stats == DETECT_STATS_SECOND && now - acc->window_start < GST_SECOND)
+    return;
+
+  s = gst_structure_new (DETECT_STATS_MESSAGE,
+      "frames", G_TYPE_UINT, acc->frames,
+      "candidates", G_TYPE_DOUBLE, (gdouble) acc->candidates / acc->frames,
+      "max-candidates", G_TYPE_UINT, acc->max_candidates,
+      "faces", G_TYPE_DOUBLE, (gdouble) acc->faces / acc->frames,
+      "decode-time", G_TYPE_UINT64, acc->decode_time / acc->frames,
+      "max-decode-time", G_TYPE_UINT64, acc->max_decode_time,
+      "nms-time", G_TYPE_UINT64, acc->nms_time / acc->frames,
+      "max-nms-time", G_TYPE_UINT64, acc->max_nms_time,
+      NULL);
+  gst_element_post_message (app->detect_stats_element,
+      gst_message_new_element (GST_OBJECT (app->detect_stats_element), s));
+
+  memset (acc, 0, sizeof (DetectStats));
+}
+
 /**
  * @brief Custom-easy filter function that transform detection to crop info
  */
@@ -366,6 +2816,19 @@ cef_func_detection_to_cropinfo (void *private_data, const GstTensorFilterPropert
   float *raw_scores = in[1].data;
   GArray *results = g_array_sized_new (FALSE, TRUE, sizeof (detectedObject), 100);
   guint *info_data = out[0].data;
+  GstClockTime t_start = 0, t_decoded = 0;
+  guint candidates;
+
+  if (app->search_window) {
+    /* set by cef_func_detect_window, earlier in the same streaming thread */
+    info->i_x = app->detect_window.x;
+    info->i_y = app->detect_window.y;
+    info->i_width = app->detect_window.width;
+    info->i_height = app->detect_window.height;
+  }
+
+  if (app->detect_stats)
+    t_start = gst_util_get_timestamp ();
 
   for (guint i = 0; i < info->num_boxes; i++) {
     detectedObject object = {.valid = FALSE, .class_id = 0, .x = 0, .y = 0, .width = 0, .height = 0, .prob = 0};
@@ -377,19 +2840,42 @@ cef_func_detection_to_cropinfo (void *private_data, const GstTensorFilterPropert
     }
   }
 
+  candidates = results->len;
+  if (app->detect_stats)
+    t_decoded = gst_util_get_timestamp ();
+
   nms (results, info->iou_thresh);
 
+  if (app->detect_stats) {
+    GstClockTime t_nms = gst_util_get_timestamp ();
+
+    detect_stats_update (app, candidates, results->len, t_decoded - t_start, t_nms - t_decoded);
+  }
+
+  app->last_face.valid = (results->len > 0);
+  if (results->len > 0)
+    app->last_face = g_array_index (results, detectedObject, 0);
+
   if (results->len == 0) {
     //_print_log ("no detected object");
+    /* the next face may be anywhere, do not keep its bucket */
+    app->bucket_prev.valid = FALSE;
     info_data[0] = 0U;
     info_data[1] = 0U;
     info_data[2] = 1U; //info->i_width;
     info_data[3] = 1U; //info->i_height;
+    if (app->rotate_crop)
+      info_data[4] = 0U;
   } else {
     detectedObject *object = &g_array_index (results, detectedObject, 0);
     detectedObject margined;
 
-    margin_object (object, &margined, 0.25, app->video_size);
+    margin_object (object, &margined,
+        app->async_detect ? ASYNC_CROP_MARGIN_RATE : CROP_MARGIN_RATE,
+        app->video_width, app->video_height);
+    if (app->crop_bucket > 0)
+      snap_crop_to_bucket (&margined, &app->bucket_prev, app->crop_bucket,
+          app->video_width, app->video_height);
     //_print_log ("detected: %d %d %d %d = %d", object->x, object->y, object->height, object->width, object->height * object->width * 3);
     //_print_log ("detected: %d %d %d %d = %d", margined.x, margined.y, margined.height, margined.width, margined.height * margined.width * 3);
 
@@ -397,7 +2883,116 @@ cef_func_detection_to_cropinfo (void *private_data, const GstTensorFilterPropert
     info_data[1] = margined.y;
     info_data[2] = margined.width;
     info_data[3] = margined.height;
+
+    if (app->rotate_crop) {
+      /* rotate the crop so that the line from the right to the left eye is horizontal */
+      gfloat angle = atan2f (
+          object->keypoints[KEYPOINT_LEFT_EYE][1] - object->keypoints[KEYPOINT_RIGHT_EYE][1],
+          object->keypoints[KEYPOINT_LEFT_EYE][0] - object->keypoints[KEYPOINT_RIGHT_EYE][0]);
+
+      info_data[4] = (guint) (gint32) lrintf (angle * CROP_INFO_ANGLE_SCALE);
+    }
+  }
+
+  if (app->async_detect) {
+    g_mutex_lock (&app->latest_lock);
+    memcpy (app->latest_crop, info_data, CROP_INFO_LEN (app) * sizeof (guint));
+    g_mutex_unlock (&app->latest_lock);
+  }
+
+  g_array_free (results, TRUE);
+  return 0;
+}
+
+/**
+ * @brief Custom-easy filter function that gives the detector a window around the last face.
+ *
+ * The window is cropped and scaled from the full resolution frame, so a
+ * small face covers more of the detector input. The whole frame is scanned
+ * when no face is known, and periodically to find new faces.
+ */
+static int
+cef_func_detect_window (void *private_data, const GstTensorFilterProperties *prop,
+    const GstTensorMemory *in, GstTensorMemory *out)
+{
+  AppData *app = private_data;
+  BlazeFaceInfo *info = &app->detect_model;
+  detectedObject *window = &app->detect_window;
+  AffineRegion region;
+
+  if (!app->last_face.valid || app->detect_frames % app->full_scan_interval == 0) {
+    /* the whole frame, letterboxed to a square */
+    window->width = MAX (app->video_width, app->video_height);
+    window->x = - (gint) (window->width - app->video_width) / 2;
+    window->y = - (gint) (window->width - app->video_height) / 2;
+  } else {
+    detectedObject *face = &app->last_face;
+    gint size = MAX (face->width, face->height) * SEARCH_WINDOW_SCALE;
+
+    size = CLAMP (size, (gint) info->tensor_width, (gint) MIN (app->video_width, app->video_height));
+    window->x = CLAMP (face->x + face->width / 2 - size / 2, 0, (gint) app->video_width - size);
+    window->y = CLAMP (face->y + face->height / 2 - size / 2, 0, (gint) app->video_height - size);
+    window->width = size;
   }
+  window->height = window->width;
+  app->detect_frames++;
+
+  region.cx = window->x + window->width / 2.0f;
+  region.cy = window->y + window->height / 2.0f;
+  region.size = window->width;
+  region.angle = 0.0f;
+  affine_warp_rgb (in[0].data, app->video_width, app->video_height, &region, out[0].data,
+      info->tensor_width, info->tensor_height);
+
+  return 0;
+}
+
+/**
+ * @brief Custom-easy filter function that gives the crop info of the latest detection.
+ *
+ * Used in async detection mode, where frame N is cropped with the result
+ * of the last finished detection (usually frame N-1).
+ */
+static int
+cef_func_latest_cropinfo (void *private_data, const GstTensorFilterProperties *prop,
+    const GstTensorMemory *in, GstTensorMemory *out)
+{
+  AppData *app = private_data;
+  guint *info_data = out[0].data;
+
+  g_mutex_lock (&app->latest_lock);
+  memcpy (info_data, app->latest_crop, CROP_INFO_LEN (app) * sizeof (guint));
+  g_mutex_unlock (&app->latest_lock);
+
+  return 0;
+}
+
+/**
+ * @brief Custom-easy filter function that warps the rotated crop region to the landmark input.
+ *
+ * Input is the source frame and its crop info, muxed. Replaces the crop
+ * and scale copies of tensor_crop and flexible_tensor_scale.
+ */
+static int
+cef_func_affine_crop (void *private_data, const GstTensorFilterProperties *prop,
+    const GstTensorMemory *in, GstTensorMemory *out)
+{
+  AppData *app = private_data;
+  AffineRegion region;
+  guint crop[4];
+  gfloat angle;
+
+  if (!parse_crop_info (in[1].data, in[1].size, crop, &angle))
+    return -1;
+
+  region.cx = crop[0] + crop[2] / 2.0f;
+  region.cy = crop[1] + crop[3] / 2.0f;
+  region.size = crop[2];
+  region.angle = angle;
+
+  affine_warp_rgb (in[0].data, app->video_width, app->video_height, &region, out[0].data,
+      app->landmark_model.tensor_width, app->landmark_model.tensor_height);
+
   return 0;
 }
 
@@ -447,7 +3042,12 @@ cd_flexible_tensor_scale (const GstTensorMemory *input, const GstTensorsConfig *
   need_alloc = (gst_buffer_get_size (out_buf) == 0);
 
   if (need_alloc) {
-    out_mem = gst_allocator_alloc (NULL, size, NULL);
+    GstAllocationParams params;
+
+    hugepage_allocator_init_params (&params);
+    out_mem = gst_allocator_alloc (app->frame_allocator, size, &params);
+    if (!out_mem)
+      return GST_FLOW_ERROR;
   } else {
     if (gst_buffer_get_size (out_buf)) {
       gst_buffer_set_size (out_buf, size);
@@ -460,86 +3060,368 @@ cd_flexible_tensor_scale (const GstTensorMemory *input, const GstTensorsConfig *
     return GST_FLOW_ERROR;
   }
   
+  scale_plan_update (&app->flexible_plan, dim[1], dim[2], width, height, dim[0]);
+
   /* neareast-neighbor */
   int h, w;
   uint8_t *ptr = (uint8_t *)out_info.data;
   uint8_t *inp = (uint8_t *)tmem->data + hsize;
   for (h = 0; h < height; h++) {
-    int h_inp = (int)((float)dim[2] / height * h);
-    uint8_t *row_inp = inp + dim[0] * dim[1] * h_inp;
+    uint8_t *row_inp = inp + app->flexible_plan.y_offset[h];
     for (w = 0; w < width; w++) {
-      int w_inp = (int)((float)dim[1] / width * w);
-      uint8_t *pix_inp = row_inp + dim[0] * w_inp;
-      memcpy (ptr, pix_inp, 3);
+      memcpy (ptr, row_inp + app->flexible_plan.x_offset[w], 3);
       ptr += 3;
     }
   }
 
   gst_memory_unmap (out_mem, &out_info);
 
-  if (need_alloc) {
-    gst_buffer_append_memory (out_buf, out_mem);
-  } else {
-    gst_memory_unref (out_mem);
-  }
+  if (need_alloc) {
+    gst_buffer_append_memory (out_buf, out_mem);
+  } else {
+    gst_memory_unref (out_mem);
+  }
+
+  return GST_FLOW_OK;
+}
+
+/**
+ * @brief Parse the input type of a model from its option string.
+ */
+static gboolean
+parse_model_input_type (const gchar *str, ModelInputType *input_type)
+{
+  if (!str || g_ascii_strcasecmp (str, "float32") == 0)
+    *input_type = MODEL_INPUT_FLOAT32;
+  else if (g_ascii_strcasecmp (str, "uint8") == 0)
+    *input_type = MODEL_INPUT_UINT8;
+  else if (g_ascii_strcasecmp (str, "int8") == 0)
+    *input_type = MODEL_INPUT_INT8;
+  else if (g_ascii_strcasecmp (str, "float16") == 0)
+    *input_type = MODEL_INPUT_FLOAT16;
+  else {
+    g_critical ("unknown model input type [%s]", str);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+init_blazeface (BlazeFaceInfo *info, const gchar *path, const gchar *model,
+    ModelInputType input_type, guint video_width, guint video_height)
+{
+  const gchar detect_model[] = "face_detection_short_range.tflite";
+  const gchar detect_box_prior[] = "box_prior_face_detection_short_range.txt";
+  const guint num_boxs = BLAZEFACE_SHORT_RANGE_NUM_BOXS;
+
+  if (model)
+    info->model_path = g_strdup (model);
+  else
+    info->model_path = g_strdup_printf ("%s/%s", path, detect_model);
+  info->input_type = input_type;
+  info->anchors_path = g_strdup_printf ("%s/%s", path, detect_box_prior);
+  info->num_boxes = num_boxs;
+  info->x_scale = 128;
+  info->y_scale = 128;
+  info->h_scale = 128;
+  info->w_scale = 128;
+  info->min_score_thresh = 0.5f;
+  info->iou_thresh = 0.3f;
+  info->tensor_width = 128;
+  info->tensor_height = 128;
+
+  /**
+   * The detector sees the frame letterboxed to a square, so the anchors
+   * cover a square region centered on the frame.
+   */
+  info->i_width = MAX (video_width, video_height);
+  info->i_height = info->i_width;
+  info->i_x = - (gint) (info->i_width - video_width) / 2;
+  info->i_y = - (gint) (info->i_height - video_height) / 2;
+
+  if (!g_file_test (info->model_path, G_FILE_TEST_IS_REGULAR)) {
+    g_critical ("cannot find tflite model [%s]", info->model_path);
+    return FALSE;
+  }
+
+  if (!g_file_test (info->anchors_path, G_FILE_TEST_IS_REGULAR)) {
+    g_critical ("cannot find tflite box_prior [%s]", info->anchors_path);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+init_landmark_model (LandmarkModelInfo *info, const gchar *path, const gchar *model,
+    ModelInputType input_type, guint video_width, guint video_height)
+{
+  const gchar landmark_model[] = "face_landmark.tflite";
+
+  if (model)
+    info->model_path = g_strdup (model);
+  else
+    info->model_path = g_strdup_printf ("%s/%s", path, landmark_model);
+  info->input_type = input_type;
+  info->tensor_width = 192;
+  info->tensor_height = 192;
+  info->i_width = video_width;
+  info->i_height = video_height;
+
+  if (!g_file_test (info->model_path, G_FILE_TEST_IS_REGULAR)) {
+    g_critical ("cannot find tflite model [%s]", info->model_path);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * @brief Pick the fastest inference options of both models within the CPU budget.
+ *
+ * Both interpreters run at the same time, so each gets half of the CPUs
+ * left after reserving one for conversion and scaling.
+ */
+static void
+autotune_inference (AppData *app)
+{
+  guint budget, max_threads;
+
+  budget = model_bench_cpu_budget ();
+  max_threads = MAX (1, (budget > 2 ? budget - 1 : budget) / 2);
+  g_print ("[autotune] %u CPUs available, up to %u threads per model\n", budget, max_threads);
+
+  model_bench_tune ("detect", app->detect_model.model_path,
+      app->detect_model.tensor_width, app->detect_model.tensor_height,
+      model_input_transform_option (app->detect_model.input_type),
+      max_threads, &app->detect_inference);
+  model_bench_tune ("landmark", app->landmark_model.model_path,
+      app->landmark_model.tensor_width, app->landmark_model.tensor_height,
+      model_input_transform_option (app->landmark_model.input_type),
+      max_threads, &app->landmark_inference);
+}
+
+/**
+ * @brief Thread function that loads the box priors of the detection model.
+ */
+static gpointer
+load_anchors_thread (gpointer data)
+{
+  blazeface_load_anchors ((BlazeFaceInfo *) data);
+  return NULL;
+}
+
+/**
+ * @brief Load both models and the anchors in parallel and run warm-up inferences.
+ *
+ * The warmed-up interpreters are shared with the app pipeline through
+ * shared-tensor-filter-key, so the first camera frames do not pay for
+ * interpreter allocation and delegate setup.
+ */
+static void
+startup_warmup (AppData *app)
+{
+  ModelWarmup *detect = &app->detect_warmup;
+  ModelWarmup *landmark = &app->landmark_warmup;
+  GThread *detect_thread, *landmark_thread, *anchors_thread;
+  gint64 start = g_get_monotonic_time ();
+  cpu_set_t saved;
+  gboolean entered;
+
+  detect->name = "detect";
+  detect->model_path = app->detect_model.model_path;
+  detect->width = app->detect_model.tensor_width;
+  detect->height = app->detect_model.tensor_height;
+  detect->transform_option = model_input_transform_option (app->detect_model.input_type);
+  detect->custom = inference_options_to_custom (&app->detect_inference);
+  detect->shared_key = "facemesh-detect";
+
+  landmark->name = "landmark";
+  landmark->model_path = app->landmark_model.model_path;
+  landmark->width = app->landmark_model.tensor_width;
+  landmark->height = app->landmark_model.tensor_height;
+  landmark->transform_option = model_input_transform_option (app->landmark_model.input_type);
+  landmark->custom = inference_options_to_custom (&app->landmark_inference);
+  landmark->shared_key = "facemesh-landmark";
+
+  /* the warmed-up interpreters are kept, their worker threads inherit the affinity of the warm-up thread */
+  entered = thread_cpus_enter (app, QUEUE_BRANCH_DETECT, &saved);
+  detect_thread = g_thread_new ("warmup-detect", model_warmup_thread, detect);
+  thread_cpus_leave (entered, &saved);
+  entered = thread_cpus_enter (app, QUEUE_BRANCH_LANDMARK, &saved);
+  landmark_thread = g_thread_new ("warmup-landmark", model_warmup_thread, landmark);
+  thread_cpus_leave (entered, &saved);
+  anchors_thread = g_thread_new ("load-anchors", load_anchors_thread, &app->detect_model);
+
+  g_thread_join (detect_thread);
+  g_thread_join (landmark_thread);
+  g_thread_join (anchors_thread);
+
+  g_print ("[warmup] detect %s in %.1f ms, landmark %s in %.1f ms, total %.1f ms\n",
+      detect->ok ? "ready" : "failed", detect->elapsed_us / 1000.0,
+      landmark->ok ? "ready" : "failed", landmark->elapsed_us / 1000.0,
+      (g_get_monotonic_time () - start) / 1000.0);
+}
+
+/**
+ * @brief A model swap, from loading the new models until the pipeline switches.
+ */
+typedef struct
+{
+  AppData *app;
+  ModelWarmup detect;
+  ModelWarmup landmark;
+  BlazeFaceInfo *anchors; /**< detection model info with the anchors read again */
+  gint64 start; /**< monotonic time of the swap request */
+} ModelSwap;
+
+/**
+ * @brief Release a model swap, the next SIGHUP may start another one.
+ */
+static void
+model_swap_free (gpointer data)
+{
+  ModelSwap *swap = data;
 
-  return GST_FLOW_OK;
+  model_warmup_release (&swap->detect);
+  model_warmup_release (&swap->landmark);
+  g_free (swap->anchors);
+  g_atomic_int_set (&swap->app->model_swap_busy, FALSE);
+  g_free (swap);
 }
 
+/**
+ * @brief Reload the model of a tensor_filter, the framework swaps the interpreter between two invokes.
+ */
 static gboolean
-init_blazeface (BlazeFaceInfo *info, const gchar *path, guint video_size)
+model_swap_reload (AppData *app, const gchar *name, const gchar *model_path)
 {
-  const gchar detect_model[] = "face_detection_short_range.tflite";
-  const gchar detect_box_prior[] = "box_prior_face_detection_short_range.txt";
-  const guint num_boxs = BLAZEFACE_SHORT_RANGE_NUM_BOXS;
+  GstElement *tfilter = gst_bin_get_by_name (GST_BIN (app->pipeline), name);
 
-  info->model_path = g_strdup_printf ("%s/%s", path, detect_model);
-  info->anchors_path = g_strdup_printf ("%s/%s", path, detect_box_prior);
-  info->num_boxes = num_boxs;
-  info->x_scale = 128;
-  info->y_scale = 128;
-  info->h_scale = 128;
-  info->w_scale = 128;
-  info->min_score_thresh = 0.5f;
-  info->iou_thresh = 0.3f;
-  info->tensor_width = 128;
-  info->tensor_height = 128;
+  if (!tfilter)
+    return FALSE;
 
-  info->i_width = video_size;
-  info->i_height = video_size;
+  g_object_set (tfilter, "model", model_path, NULL);
+  gst_object_unref (tfilter);
+  return TRUE;
+}
 
-  if (!g_file_test (info->model_path, G_FILE_TEST_IS_REGULAR)) {
-    g_critical ("cannot find tflite model [%s]", info->model_path);
-    return FALSE;
+/**
+ * @brief Thread function that checks the new models, then switches the pipeline to them.
+ *
+ * The model files are read again from the configured paths, so a rollout
+ * replaces the files and sends SIGHUP. Each model first runs a few
+ * inferences in a separate pipeline, which also brings the file into the
+ * page cache. If either model or the anchors fail, the pipeline keeps the
+ * models it runs.
+ *
+ * The anchors cannot switch at the same frame as the detector, so a new
+ * detection model is only taken with the anchors of the running one. They
+ * depend on the model architecture only, a retrained model keeps them.
+ *
+ * The reload of each tensor_filter runs in this thread: the framework
+ * builds the interpreter, delegate included, while the running one keeps
+ * serving, and swaps them between two invokes. No streaming thread waits
+ * for a model load.
+ */
+static gpointer
+model_swap_thread (gpointer data)
+{
+  ModelSwap *swap = data;
+  AppData *app = swap->app;
+  GThread *detect_thread, *landmark_thread;
+  gboolean anchors_ok, entered;
+  cpu_set_t saved;
+  guint i;
+
+  swap->detect.name = "detect";
+  swap->detect.model_path = app->detect_model.model_path;
+  swap->detect.width = app->detect_model.tensor_width;
+  swap->detect.height = app->detect_model.tensor_height;
+  swap->detect.transform_option = model_input_transform_option (app->detect_model.input_type);
+  swap->detect.custom = inference_options_to_custom (&app->detect_inference);
+
+  swap->landmark.name = "landmark";
+  swap->landmark.model_path = app->landmark_model.model_path;
+  swap->landmark.width = app->landmark_model.tensor_width;
+  swap->landmark.height = app->landmark_model.tensor_height;
+  swap->landmark.transform_option = model_input_transform_option (app->landmark_model.input_type);
+  swap->landmark.custom = inference_options_to_custom (&app->landmark_inference);
+
+  detect_thread = g_thread_new ("swap-detect", model_warmup_thread, &swap->detect);
+  landmark_thread = g_thread_new ("swap-landmark", model_warmup_thread, &swap->landmark);
+
+  swap->anchors = g_new (BlazeFaceInfo, 1);
+  *swap->anchors = app->detect_model;
+  anchors_ok = blazeface_load_anchors (swap->anchors);
+
+  g_thread_join (detect_thread);
+  g_thread_join (landmark_thread);
+
+  g_print ("[swap] detect %s in %.1f ms, landmark %s in %.1f ms, anchors %s\n",
+      swap->detect.ok ? "ready" : "failed", swap->detect.elapsed_us / 1000.0,
+      swap->landmark.ok ? "ready" : "failed", swap->landmark.elapsed_us / 1000.0,
+      anchors_ok ? "ready" : "failed");
+
+  if (anchors_ok && memcmp (swap->anchors->anchors, app->detect_model.anchors,
+          sizeof (app->detect_model.anchors)) != 0) {
+    g_printerr ("[swap] the anchors changed, a new detection model architecture needs a restart.\n");
+    anchors_ok = FALSE;
   }
 
-  if (!g_file_test (info->anchors_path, G_FILE_TEST_IS_REGULAR)) {
-    g_critical ("cannot find tflite box_prior [%s]", info->anchors_path);
-    return FALSE;
+  if (!swap->detect.ok || !swap->landmark.ok || !anchors_ok) {
+    g_printerr ("[swap] keeping the running models.\n");
+    model_swap_free (swap);
+    return NULL;
   }
 
-  blazeface_load_anchors (info);
+  /* no anchors to keep in step with the landmark model, each instance switches on its own */
+  entered = thread_cpus_enter (app, QUEUE_BRANCH_LANDMARK, &saved);
+  for (i = 0; i < app->landmark_instances; i++) {
+    gchar *name = app->landmark_instances > 1 ?
+        g_strdup_printf ("tfilter_landmark_%u", i) : g_strdup ("tfilter_landmark");
 
-  return TRUE;
+    model_swap_reload (app, name, app->landmark_model.model_path);
+    g_free (name);
+  }
+  thread_cpus_leave (entered, &saved);
+  g_print ("[swap] landmark switched %.1f ms after the request\n",
+      (g_get_monotonic_time () - swap->start) / 1000.0);
+
+  entered = thread_cpus_enter (app, QUEUE_BRANCH_DETECT, &saved);
+  model_swap_reload (app, "tfilter_detect", app->detect_model.model_path);
+  thread_cpus_leave (entered, &saved);
+  g_print ("[swap] detect switched %.1f ms after the request\n",
+      (g_get_monotonic_time () - swap->start) / 1000.0);
+
+  model_swap_free (swap);
+  return NULL;
 }
 
+/**
+ * @brief SIGHUP handler, loads the models again in the background.
+ */
 static gboolean
-init_landmark_model (LandmarkModelInfo *info, const gchar *path, guint video_size)
+model_swap_signal_cb (gpointer user_data)
 {
-  const gchar landmark_model[] = "face_landmark.tflite";
+  AppData *app = user_data;
+  ModelSwap *swap;
 
-  info->model_path = g_strdup_printf ("%s/%s", path, landmark_model);
-  info->tensor_width = 192;
-  info->tensor_height = 192;
-  info->i_width = video_size;
-  info->i_height = video_size;
-
-  if (!g_file_test (info->model_path, G_FILE_TEST_IS_REGULAR)) {
-    g_critical ("cannot find tflite model [%s]", info->model_path);
-    return FALSE;
+  if (!g_atomic_int_compare_and_exchange (&app->model_swap_busy, FALSE, TRUE)) {
+    g_print ("[swap] a model swap is in progress, ignored.\n");
+    return G_SOURCE_CONTINUE;
   }
 
-  return TRUE;
+  if (app->model_swap_thread)
+    g_thread_join (app->model_swap_thread);
+
+  swap = g_new0 (ModelSwap, 1);
+  swap->app = app;
+  swap->start = g_get_monotonic_time ();
+  app->model_swap_thread = g_thread_new ("model-swap", model_swap_thread, swap);
+
+  return G_SOURCE_CONTINUE;
 }
 
 gboolean 
@@ -548,13 +3430,136 @@ init_app (AppData *app)
   GstTensorsInfo info_in;
   GstTensorsInfo info_out;
   const gchar resource_path[] = "./res";
+  gchar *model_name;
+  ModelInputType detect_input, landmark_input;
+
+  if (app->capture_width > 0 && app->capture_height > 0) {
+    app->video_width = app->capture_width;
+    app->video_height = app->capture_height;
+  } else if (app->capture_width > 0 || app->capture_height > 0) {
+    g_printerr ("both capture width and height must be given.\n");
+    return FALSE;
+  } else {
+    app->video_width = 720;
+    app->video_height = 720;
+  }
+  app->queue_stats = g_ptr_array_new_with_free_func (g_free);
+  app->frame_allocator = hugepage_allocator_get ();
+
+  if (!app->profile_name || g_str_equal (app->profile_name, "default")) {
+    app->profile = PIPELINE_PROFILE_DEFAULT;
+  } else if (g_str_equal (app->profile_name, "realtime")) {
+    app->profile = PIPELINE_PROFILE_REALTIME;
+  } else if (g_str_equal (app->profile_name, "throughput")) {
+    app->profile = PIPELINE_PROFILE_THROUGHPUT;
+  } else if (g_str_equal (app->profile_name, "batch")) {
+    app->profile = PIPELINE_PROFILE_BATCH;
+  } else {
+    g_printerr ("unknown pipeline profile %s.\n", app->profile_name);
+    return FALSE;
+  }
+
+  if (!thread_policies_parse (app))
+    return FALSE;
+
+  if (!app->detect_stats_mode || g_str_equal (app->detect_stats_mode, "off")) {
+    app->detect_stats = DETECT_STATS_OFF;
+  } else if (g_str_equal (app->detect_stats_mode, "frame")) {
+    app->detect_stats = DETECT_STATS_FRAME;
+  } else if (g_str_equal (app->detect_stats_mode, "second")) {
+    app->detect_stats = DETECT_STATS_SECOND;
+  } else {
+    g_printerr ("unknown detection statistics mode %s.\n", app->detect_stats_mode);
+    return FALSE;
+  }
+
+  if (!parse_model_input_type (app->detect_input, &detect_input)
+      || !parse_model_input_type (app->landmark_input, &landmark_input)) {
+    return FALSE;
+  }
+
+  init_blazeface (&app->detect_model, resource_path, app->detect_model_path,
+      detect_input, app->video_width, app->video_height);
+  init_landmark_model (&app->landmark_model, resource_path, app->landmark_model_path,
+      landmark_input, app->video_width, app->video_height);
+
+  if (app->autotune)
+    autotune_inference (app);
 
-  app->video_size = 720;
-  init_blazeface (&app->detect_model, resource_path, app->video_size);
-  init_landmark_model (&app->landmark_model, resource_path, app->video_size);
+  if (app->warmup) {
+    startup_warmup (app);
+  } else {
+    blazeface_load_anchors (&app->detect_model);
+  }
 
   app->loop = g_main_loop_new (NULL, FALSE);
 
+  g_mutex_init (&app->result_lock);
+  g_mutex_init (&app->latest_lock);
+  g_mutex_init (&app->reorder_lock);
+  g_mutex_init (&app->detect_batch_lock);
+
+  if (app->full_scan_interval == 0)
+    app->full_scan_interval = DEFAULT_FULL_SCAN_INTERVAL;
+
+  if (app->detect_batch > 1) {
+    /* the search window follows the previous detection, which a batch has not seen yet */
+    if (!app->batch_uri || app->search_window) {
+      g_printerr ("detector batching is only supported in batch mode without search window.\n");
+      return FALSE;
+    }
+    if (app->detect_batch > DETECT_BATCH_MAX) {
+      g_printerr ("at most %d frames per detector batch are supported.\n", DETECT_BATCH_MAX);
+      return FALSE;
+    }
+  }
+
+  if (app->latency_budget > 0) {
+    /**
+     * The controller thins out the detector frames. The crop of each frame
+     * must then come from the latest detection, otherwise the frames whose
+     * detection was dropped are dropped by the crop as well.
+     */
+    app->async_detect = TRUE;
+  }
+
+  if (app->landmark_instances == 0)
+    app->landmark_instances = 1;
+  if (app->landmark_instances > LANDMARK_INSTANCES_MAX) {
+    g_printerr ("at most %d landmark instances are supported.\n", LANDMARK_INSTANCES_MAX);
+    return FALSE;
+  }
+  if (app->landmark_interval > 1 && app->landmark_instances > 1) {
+    /* the frames skipped by the interval would stall the reordering of the instances */
+    g_printerr ("landmark interval is not supported with several landmark instances.\n");
+    return FALSE;
+  }
+  /* no face until the first detection */
+  app->latest_crop[0] = 0U;
+  app->latest_crop[1] = 0U;
+  app->latest_crop[2] = 1U;
+  app->latest_crop[3] = 1U;
+  app->latest_crop[4] = 0U;
+  for (guint i = 0; i < CROP_HISTORY_SIZE; i++)
+    app->crop_history[i].pts = GST_CLOCK_TIME_NONE;
+  app->reorder_last_pts = GST_CLOCK_TIME_NONE;
+
+  if (app->result_shm) {
+    app->result_ring = landmark_ring_create (app->result_shm, app->result_shm_slots);
+    if (!app->result_ring) {
+      g_printerr ("landmark result ring %s could not be created.\n", app->result_shm);
+      return FALSE;
+    }
+  }
+
+  if (app->result_archive) {
+    app->archive = landmark_archive_create (app->result_archive, 0);
+    if (!app->archive) {
+      g_printerr ("landmark archive %s could not be created.\n", app->result_archive);
+      return FALSE;
+    }
+  }
+
   /* register custom crop_info filter */
   gst_tensors_info_init (&info_in);
   gst_tensors_info_init (&info_out);
@@ -569,11 +3574,80 @@ init_app (AppData *app)
   info_out.num_tensors = 1U;
   info_out.info[0].name = NULL;
   info_out.info[0].type = _NNS_UINT32;
-  gst_tensor_parse_dimension ("4:1", info_out.info[0].dimension);
-  NNS_custom_easy_register ("detection_to_cropinfo", cef_func_detection_to_cropinfo, app, &info_in, &info_out);
+  gst_tensor_parse_dimension (app->rotate_crop ? "5:1" : "4:1", info_out.info[0].dimension);
+  model_name = app_model_name (app, "detection_to_cropinfo");
+  NNS_custom_easy_register (model_name, cef_func_detection_to_cropinfo, app, &info_in, &info_out);
+  g_free (model_name);
+
+  if (app->async_detect) {
+    gchar *dim;
+
+    /* register custom latest crop_info filter, input is the source frame */
+    info_in.num_tensors = 1U;
+    info_in.info[0].type = _NNS_UINT8;
+    dim = g_strdup_printf ("3:%u:%u", app->video_width, app->video_height);
+    gst_tensor_parse_dimension (dim, info_in.info[0].dimension);
+    g_free (dim);
+    model_name = app_model_name (app, "latest_cropinfo");
+    NNS_custom_easy_register (model_name, cef_func_latest_cropinfo, app, &info_in, &info_out);
+    g_free (model_name);
+  }
+
+  if (app->search_window) {
+    GstTensorsInfo info_frame, info_window;
+    gchar *dim;
+
+    /* register custom detection window filter, input is the source frame */
+    gst_tensors_info_init (&info_frame);
+    gst_tensors_info_init (&info_window);
+    info_frame.num_tensors = 1U;
+    info_frame.info[0].name = NULL;
+    info_frame.info[0].type = _NNS_UINT8;
+    dim = g_strdup_printf ("3:%u:%u", app->video_width, app->video_height);
+    gst_tensor_parse_dimension (dim, info_frame.info[0].dimension);
+    g_free (dim);
+
+    info_window.num_tensors = 1U;
+    info_window.info[0].name = NULL;
+    info_window.info[0].type = _NNS_UINT8;
+    dim = g_strdup_printf ("3:%u:%u", app->detect_model.tensor_width, app->detect_model.tensor_height);
+    gst_tensor_parse_dimension (dim, info_window.info[0].dimension);
+    g_free (dim);
+    model_name = app_model_name (app, "detect_window");
+    NNS_custom_easy_register (model_name, cef_func_detect_window, app, &info_frame, &info_window);
+    g_free (model_name);
+  }
+
+  if (app->rotate_crop) {
+    GstTensorsInfo info_crop;
+    gchar *dim;
+
+    /* register custom affine crop filter, input is the source frame and its crop info */
+    gst_tensors_info_init (&info_crop);
+    info_in.num_tensors = 2U;
+    info_in.info[0].type = _NNS_UINT8;
+    dim = g_strdup_printf ("3:%u:%u", app->video_width, app->video_height);
+    gst_tensor_parse_dimension (dim, info_in.info[0].dimension);
+    g_free (dim);
+    info_in.info[1].type = _NNS_UINT32;
+    gst_tensor_parse_dimension ("5:1", info_in.info[1].dimension);
+
+    info_crop.num_tensors = 1U;
+    info_crop.info[0].name = NULL;
+    info_crop.info[0].type = _NNS_UINT8;
+    dim = g_strdup_printf ("3:%u:%u", app->landmark_model.tensor_width, app->landmark_model.tensor_height);
+    gst_tensor_parse_dimension (dim, info_crop.info[0].dimension);
+    g_free (dim);
+    model_name = app_model_name (app, "affine_crop");
+    NNS_custom_easy_register (model_name, cef_func_affine_crop, app, &info_in, &info_crop);
+    g_free (model_name);
+  }
 
   /* register custom flexible tensor to video decoder */
-  nnstreamer_decoder_custom_register ("flexible_tensor_scale", cd_flexible_tensor_scale, app);
+  model_name = app_model_name (app, "flexible_tensor_scale");
+  nnstreamer_decoder_custom_register (model_name, cd_flexible_tensor_scale, app);
+  g_free (model_name);
+  app->custom_registered = TRUE;
 
   if (!build_pipeline (app)) {
     return FALSE;
@@ -597,20 +3671,535 @@ message_cb (GstBus *bus, GstMessage *msg, AppData *app)
       g_free (debug_info);
       g_main_loop_quit (app->loop);
       break;
+    case GST_MESSAGE_ELEMENT:
+    {
+      const GstStructure *s = gst_message_get_structure (msg);
+
+      if (gst_structure_has_name (s, DETECT_STATS_MESSAGE)) {
+        guint frames, max_candidates;
+        gdouble candidates, faces;
+        guint64 decode_time, max_decode_time, nms_time, max_nms_time;
+
+        gst_structure_get (s, "frames", G_TYPE_UINT, &frames,
+            "candidates", G_TYPE_DOUBLE, &candidates,
+            "max-candidates", G_TYPE_UINT, &max_candidates,
+            "faces", G_TYPE_DOUBLE, &faces,
+            "decode-time", G_TYPE_UINT64, &decode_time,
+            "max-decode-time", G_TYPE_UINT64, &max_decode_time,
+            "nms-time", G_TYPE_UINT64, &nms_time,
+            "max-nms-time", G_TYPE_UINT64, &max_nms_time, NULL);
+        g_print ("[detect] %u frames: candidates %.1f (max %u), faces %.2f, "
+            "decode %.1f us (max %.1f), nms %.1f us (max %.1f)\n",
+            frames, candidates, max_candidates, faces,
+            decode_time / 1000.0, max_decode_time / 1000.0,
+            nms_time / 1000.0, max_nms_time / 1000.0);
+      }
+      break;
+    }
     default:
       // g_printerr ("msg from %s:  %s\n", GST_OBJECT_NAME (msg->src), gst_message_type_get_name (GST_MESSAGE_TYPE (msg)));
       break;
   }
 }
 
+/**
+ * @brief Unregister a custom-easy filter of this app.
+ */
+static void
+app_unregister_filter (AppData *app, const gchar *name)
+{
+  gchar *model_name = app_model_name (app, name);
+
+  NNS_custom_easy_unregister (model_name);
+  g_free (model_name);
+}
+
+/**
+ * @brief Unregister the custom filters and decoder of this app, they point to its state.
+ */
+static void
+app_unregister_custom (AppData *app)
+{
+  gchar *model_name;
+
+  if (!app->custom_registered)
+    return;
+
+  app_unregister_filter (app, "detection_to_cropinfo");
+  if (app->async_detect)
+    app_unregister_filter (app, "latest_cropinfo");
+  if (app->search_window)
+    app_unregister_filter (app, "detect_window");
+  if (app->rotate_crop)
+    app_unregister_filter (app, "affine_crop");
+
+  model_name = app_model_name (app, "flexible_tensor_scale");
+  nnstreamer_decoder_custom_unregister (model_name);
+  g_free (model_name);
+  app->custom_registered = FALSE;
+}
+
+/**
+ * @brief Release the pipeline and the resources made by init_app, also after init_app failed.
+ */
+static void
+free_app (AppData *app)
+{
+  gboolean adapt_started = app->adapt.source_id != 0;
+
+  if (app->queue_monitor_id)
+    g_source_remove (app->queue_monitor_id);
+  if (app->adapt.source_id) {
+    g_source_remove (app->adapt.source_id);
+    app->adapt.source_id = 0;
+  }
+  if (app->alloc_trace)
+    alloc_trace_stop (app->alloc_trace);
+  if (app->model_swap_id)
+    g_source_remove (app->model_swap_id);
+  if (app->model_swap_thread)
+    g_thread_join (app->model_swap_thread);
+  if (app->pipeline) {
+    gst_element_set_state (app->pipeline, GST_STATE_NULL);
+    gst_object_unref (app->pipeline);
+  }
+  /* a batch registers them again for each file, with the state of its worker */
+  app_unregister_custom (app);
+  if (adapt_started)
+    g_mutex_clear (&app->adapt.lock);
+  if (app->alloc_trace) {
+    /* memories still live after the pipeline is gone are leaks */
+    alloc_trace_print (app->alloc_trace);
+    alloc_trace_free (app->alloc_trace);
+  }
+  if (app->loop) {
+    /* the locks are made with the loop */
+    g_main_loop_unref (app->loop);
+    g_mutex_clear (&app->result_lock);
+    g_mutex_clear (&app->latest_lock);
+    g_mutex_clear (&app->reorder_lock);
+    g_mutex_clear (&app->detect_batch_lock);
+  }
+  model_warmup_release (&app->detect_warmup);
+  model_warmup_release (&app->landmark_warmup);
+
+  if (app->result_ring) {
+    g_print ("landmark results: %" G_GUINT64_FORMAT " written\n",
+        landmark_ring_get_written (app->result_ring));
+    landmark_ring_close (app->result_ring);
+  }
+  if (app->crop_history_misses > 0) {
+    g_printerr ("landmark results without crop info: %" G_GUINT64_FORMAT " not published\n",
+        app->crop_history_misses);
+  }
+  if (app->archive) {
+    _print_log ("landmark archive: %" G_GUINT64_FORMAT " bytes",
+        landmark_archive_get_bytes (app->archive));
+    if (landmark_archive_finish (app->archive) < 0)
+      g_printerr ("landmark archive could not be completed.\n");
+    app->archive = NULL;
+  }
+  if (app->queue_stats)
+    g_ptr_array_unref (app->queue_stats);
+  g_free (app->flexible_plan.x_offset);
+  g_free (app->flexible_plan.y_offset);
+  g_free (app->detect_model.model_path);
+  g_free (app->detect_model.anchors_path);
+  g_free (app->landmark_model.model_path);
+  if (app->frame_allocator)
+    gst_object_unref (app->frame_allocator);
+}
+
+/**
+ * @brief Release the command line options.
+ */
+static void
+free_options (AppData *app)
+{
+  g_free (app->detect_model_path);
+  g_free (app->detect_input);
+  g_free (app->landmark_model_path);
+  g_free (app->landmark_input);
+  g_free (app->profile_name);
+  g_free (app->detect_stats_mode);
+  g_strfreev (app->thread_affinity);
+  g_strfreev (app->thread_sched);
+  g_free (app->capture_format);
+  g_free (app->result_shm);
+  g_free (app->result_archive);
+  g_strfreev (app->batch_inputs);
+  g_free (app->batch_output);
+}
+
+/**
+ * @brief Shared state of the batch workers.
+ */
+typedef struct
+{
+  const AppData *options; /**< command line options, copied into each pipeline */
+  GPtrArray *files; /**< video files to process */
+  guint next; /**< index of the next file to take, atomic */
+  guint failed; /**< number of files which failed, atomic */
+  GMutex lock; /**< lock for total_frames and the console */
+  guint64 total_frames;
+} BatchState;
+
+/**
+ * @brief Collect the video files of the batch inputs, directories are listed one level deep.
+ */
+static void
+batch_collect_files (gchar **inputs, GPtrArray *files)
+{
+  for (; inputs && *inputs; inputs++) {
+    GDir *dir;
+    GPtrArray *entries;
+    const gchar *name;
+
+    if (!g_file_test (*inputs, G_FILE_TEST_IS_DIR)) {
+      g_ptr_array_add (files, g_strdup (*inputs));
+      continue;
+    }
+
+    dir = g_dir_open (*inputs, 0, NULL);
+    if (!dir) {
+      g_printerr ("[BATCH] cannot open directory %s.\n", *inputs);
+      continue;
+    }
+
+    /* keep a stable order, g_dir_read_name() returns entries in any order */
+    entries = g_ptr_array_new ();
+    while ((name = g_dir_read_name (dir)) != NULL) {
+      gchar *path = g_build_filename (*inputs, name, NULL);
+
+      if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+        g_ptr_array_add (entries, path);
+      else
+        g_free (path);
+    }
+    g_dir_close (dir);
+
+    g_ptr_array_sort (entries, (GCompareFunc) g_strcmp0);
+    for (guint i = 0; i < entries->len; i++)
+      g_ptr_array_add (files, g_ptr_array_index (entries, i));
+    g_ptr_array_free (entries, TRUE);
+  }
+}
+
+/**
+ * @brief Run one pipeline over a video file and write its per-frame results.
+ *
+ * Each row of the result file has the pts, the crop info (x, y, w, h, angle),
+ * the landmark score and the landmarks (x, y, z) in frame pixels, mapped
+ * through the crop and its rotation. z is scaled like x.
+ * @return TRUE if the file was processed to the end.
+ */
+static gboolean
+batch_process_file (BatchState *batch, guint index)
+{
+  const gchar *file = g_ptr_array_index (batch->files, index);
+  AppData app = *batch->options;
+  GError *err = NULL;
+  GstBus *bus;
+  GstMessage *msg;
+  gchar *base, *out_name, *out_path;
+  gboolean ret = FALSE;
+  gint64 start;
+
+  /* options are shared, only the runtime state is per pipeline */
+  app.name_suffix = g_strdup_printf ("_%u", index);
+  app.batch_uri = gst_filename_to_uri (file, &err);
+  app.profile_name = (gchar *) "batch";
+  app.autotune = FALSE;
+  app.warmup = FALSE;
+  app.result_shm = NULL;
+  app.result_archive = NULL;
+  app.latency_budget = 0;
+  if (app.detect_inference.num_threads <= 0)
+    app.detect_inference.num_threads = 1;
+  if (app.landmark_inference.num_threads <= 0)
+    app.landmark_inference.num_threads = 1;
+
+  if (!app.batch_uri) {
+    g_printerr ("[BATCH] %s: %s\n", file, err->message);
+    g_clear_error (&err);
+    g_free (app.name_suffix);
+    return FALSE;
+  }
+
+  base = g_path_get_basename (file);
+  out_name = g_strconcat (base, app.batch_archive ? ".facemesh.fmla" : ".facemesh.csv", NULL);
+  out_path = g_build_filename (batch->options->batch_output ? batch->options->batch_output : ".",
+      out_name, NULL);
+  g_free (out_name);
+  g_free (base);
+
+  if (app.batch_archive) {
+    app.archive = landmark_archive_create (out_path, 0);
+    if (!app.archive) {
+      g_printerr ("[BATCH] cannot write %s.\n", out_path);
+      goto out;
+    }
+  } else {
+    app.batch_file = fopen (out_path, "w");
+    if (!app.batch_file) {
+      g_printerr ("[BATCH] cannot write %s.\n", out_path);
+      goto out;
+    }
+    fputs ("pts,crop_x,crop_y,crop_w,crop_h,angle,score", app.batch_file);
+    for (guint i = 0; i < LANDMARK_RING_NUM_COORDS / 3; i++)
+      fprintf (app.batch_file, ",x%u,y%u,z%u", i, i, i);
+    fputc ('\n', app.batch_file);
+  }
+
+  start = g_get_monotonic_time ();
+  if (!init_app (&app)) {
+    g_printerr ("[BATCH] %s: pipeline could not be created.\n", file);
+    free_app (&app);
+    goto out;
+  }
+
+  app_start_pipeline (&app);
+
+  bus = gst_element_get_bus (app.pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("[BATCH] %s: %s\n", file, err->message);
+    g_clear_error (&err);
+  } else {
+    ret = TRUE;
+  }
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  free_app (&app);
+
+  g_mutex_lock (&batch->lock);
+  batch->total_frames += app.batch_frames;
+  g_print ("[BATCH] %s: %" G_GUINT64_FORMAT " frames, %.1f frames/s -> %s\n", file,
+      app.batch_frames, app.batch_frames * 1000000.0 / MAX (g_get_monotonic_time () - start, 1),
+      out_path);
+  g_mutex_unlock (&batch->lock);
+
+out:
+  if (app.batch_file)
+    fclose (app.batch_file);
+  if (app.archive)
+    landmark_archive_finish (app.archive);
+  g_free (out_path);
+  g_free (app.batch_uri);
+  g_free (app.name_suffix);
+  return ret;
+}
+
+/**
+ * @brief Thread function that takes files from the batch until none is left.
+ */
+static gpointer
+batch_worker_thread (gpointer data)
+{
+  BatchState *batch = data;
+  guint index;
+
+  while ((index = g_atomic_int_add (&batch->next, 1)) < batch->files->len) {
+    if (!batch_process_file (batch, index))
+      g_atomic_int_inc (&batch->failed);
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Process the batch inputs with concurrent pipelines.
+ *
+ * Each pipeline runs its interpreters single-threaded by default, so the
+ * cores are spread over files rather than over the layers of one frame.
+ * @return 0 if every file was processed.
+ */
+static int
+run_batch (AppData *options)
+{
+  BatchState batch = { 0 };
+  GPtrArray *workers;
+  guint jobs;
+  gint64 start = g_get_monotonic_time ();
+  gdouble elapsed;
+
+  batch.options = options;
+  batch.files = g_ptr_array_new_with_free_func (g_free);
+  g_mutex_init (&batch.lock);
+  batch_collect_files (options->batch_inputs, batch.files);
+
+  if (batch.files->len == 0) {
+    g_printerr ("[BATCH] no video files to process.\n");
+    g_ptr_array_unref (batch.files);
+    g_mutex_clear (&batch.lock);
+    return -1;
+  }
+
+  if (options->batch_output)
+    g_mkdir_with_parents (options->batch_output, 0755);
+
+  /* a pipeline keeps about two cores busy, detection and landmark */
+  jobs = options->batch_jobs > 0 ? (guint) options->batch_jobs : MAX (1, model_bench_cpu_budget () / 2);
+  jobs = MIN (jobs, batch.files->len);
+  g_print ("[BATCH] %u files, %u pipelines\n", batch.files->len, jobs);
+
+  workers = g_ptr_array_new ();
+  for (guint i = 0; i < jobs; i++)
+    g_ptr_array_add (workers, g_thread_new ("batch", batch_worker_thread, &batch));
+  for (guint i = 0; i < workers->len; i++)
+    g_thread_join (g_ptr_array_index (workers, i));
+  g_ptr_array_free (workers, TRUE);
+
+  elapsed = (g_get_monotonic_time () - start) / 1000000.0;
+  g_print ("[BATCH] %u of %u files done, %" G_GUINT64_FORMAT " frames in %.1f s, %.1f frames/s\n",
+      batch.files->len - batch.failed, batch.files->len, batch.total_frames, elapsed,
+      batch.total_frames / MAX (elapsed, 1e-6));
+
+  g_ptr_array_unref (batch.files);
+  g_mutex_clear (&batch.lock);
+  return batch.failed ? -1 : 0;
+}
+
+/**
+ * @brief Parse command line options of the app.
+ */
+static gboolean
+parse_options (AppData *app, int *argc, char ***argv)
+{
+  GOptionContext *context;
+  GError *err = NULL;
+  gboolean ret;
+  GOptionEntry entries[] = {
+    { "detect-model", 0, 0, G_OPTION_ARG_FILENAME, &app->detect_model_path,
+        "Face detection tflite model", "FILE" },
+    { "detect-input", 0, 0, G_OPTION_ARG_STRING, &app->detect_input,
+        "Input type of the face detection model: float32 (default), float16, uint8 or int8", "TYPE" },
+    { "landmark-model", 0, 0, G_OPTION_ARG_FILENAME, &app->landmark_model_path,
+        "Face landmark tflite model", "FILE" },
+    { "landmark-input", 0, 0, G_OPTION_ARG_STRING, &app->landmark_input,
+        "Input type of the face landmark model: float32 (default), float16, uint8 or int8", "TYPE" },
+    { "detect-threads", 0, 0, G_OPTION_ARG_INT, &app->detect_inference.num_threads,
+        "Interpreter threads of the face detection model", "N" },
+    { "detect-xnnpack", 0, 0, G_OPTION_ARG_NONE, &app->detect_inference.xnnpack,
+        "Run the face detection model with the XNNPACK delegate", NULL },
+    { "landmark-threads", 0, 0, G_OPTION_ARG_INT, &app->landmark_inference.num_threads,
+        "Interpreter threads of the face landmark model", "N" },
+    { "landmark-xnnpack", 0, 0, G_OPTION_ARG_NONE, &app->landmark_inference.xnnpack,
+        "Run the face landmark model with the XNNPACK delegate", NULL },
+    { "autotune", 0, 0, G_OPTION_ARG_NONE, &app->autotune,
+        "Benchmark inference options at startup and use the fastest", NULL },
+    { "warmup", 0, 0, G_OPTION_ARG_NONE, &app->warmup,
+        "Load and warm up both models in parallel before the camera starts", NULL },
+    { "capture-width", 0, 0, G_OPTION_ARG_INT, &app->capture_width,
+        "Camera frame width, frames keep the camera geometry (default: crop and scale to 720x720)", "W" },
+    { "capture-height", 0, 0, G_OPTION_ARG_INT, &app->capture_height,
+        "Camera frame height", "H" },
+    { "capture-format", 0, 0, G_OPTION_ARG_STRING, &app->capture_format,
+        "Camera raw video format (e.g. YUY2, NV12)", "FORMAT" },
+    { "profile", 0, 0, G_OPTION_ARG_STRING, &app->profile_name,
+        "Pipeline profile: default, realtime (leaky 1-deep queues) or throughput (deep queues)", "NAME" },
+    { "async-detect", 0, 0, G_OPTION_ARG_NONE, &app->async_detect,
+        "Crop each frame with the latest finished detection, so detection overlaps landmark inference", NULL },
+    { "landmark-instances", 0, 0, G_OPTION_ARG_INT, &app->landmark_instances,
+        "Run the landmark model on N interpreters in parallel, frames are dealt round-robin", "N" },
+    { "landmark-interval", 0, 0, G_OPTION_ARG_INT, &app->landmark_interval,
+        "Run the landmark model on one frame out of N and extrapolate the landmarks of the others", "N" },
+    { "rotate-crop", 0, 0, G_OPTION_ARG_NONE, &app->rotate_crop,
+        "Align the crop with the eye line of the face and warp it to the landmark input in one pass", NULL },
+    { "search-window", 0, 0, G_OPTION_ARG_NONE, &app->search_window,
+        "Run the detector on a window around the last face, with periodic full-frame scans", NULL },
+    { "full-scan-interval", 0, 0, G_OPTION_ARG_INT, &app->full_scan_interval,
+        "Scan the full frame every N detections in search window mode (default 15)", "N" },
+    { "crop-bucket", 0, 0, G_OPTION_ARG_INT, &app->crop_bucket,
+        "Snap crop sizes to multiples of N pixels with hysteresis, so scale plans and buffers are reused", "N" },
+    { "thread-affinity", 0, 0, G_OPTION_ARG_STRING_ARRAY, &app->thread_affinity,
+        "Pin the streaming threads of a branch (detect, crop, landmark, result or source) to CPUs, "
+        "the interpreter threads too for detect and landmark, e.g. landmark=4-7, may be repeated", "BRANCH=CPUS" },
+    { "thread-sched", 0, 0, G_OPTION_ARG_STRING_ARRAY, &app->thread_sched,
+        "Scheduling of the streaming threads of a branch: nice:N, fifo:PRIO or rr:PRIO, "
+        "e.g. result=nice:10, may be repeated", "BRANCH=POLICY" },
+    { "latency-budget", 0, 0, G_OPTION_ARG_INT, &app->latency_budget,
+        "Hold the frame latency under MS by thinning out detection, preview, landmark and input frames under load, "
+        "implies --async-detect", "MS" },
+    { "queue-monitor", 0, 0, G_OPTION_ARG_INT, &app->queue_monitor,
+        "Sample queue levels and report the bottleneck branch every N seconds", "N" },
+    { "detect-stats", 0, 0, G_OPTION_ARG_STRING, &app->detect_stats_mode,
+        "Post detection postprocess statistics on the bus: off (default), frame or second", "MODE" },
+    { "trace-alloc", 0, 0, G_OPTION_ARG_NONE, &app->trace_alloc,
+        "Count buffer allocations per element and print a table at exit", NULL },
+    { "minimal-registry", 0, 0, G_OPTION_ARG_NONE, &app->minimal_registry,
+        "Use the cached plugin registry without rescanning plugin directories", NULL },
+    { "result-shm", 0, 0, G_OPTION_ARG_STRING, &app->result_shm,
+        "Publish landmark results to a shared memory ring (e.g. /facemesh)", "NAME" },
+    { "result-shm-slots", 0, 0, G_OPTION_ARG_INT, &app->result_shm_slots,
+        "Number of slots in the shared memory ring", "N" },
+    { "result-archive", 0, 0, G_OPTION_ARG_FILENAME, &app->result_archive,
+        "Write landmark results to a compact binary archive file", "FILE" },
+    { "batch", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &app->batch_inputs,
+        "Process a video file or a directory of video files offline instead of the camera, may be repeated", "PATH" },
+    { "batch-jobs", 0, 0, G_OPTION_ARG_INT, &app->batch_jobs,
+        "Pipelines running at once in batch mode (default: half of the available CPUs)", "N" },
+    { "batch-output", 0, 0, G_OPTION_ARG_FILENAME, &app->batch_output,
+        "Directory of the per-file results in batch mode (default: current directory)", "DIR" },
+    { "batch-archive", 0, 0, G_OPTION_ARG_NONE, &app->batch_archive,
+        "Write per-file landmark archives (.fmla) instead of CSV in batch mode", NULL },
+    { "detect-batch", 0, 0, G_OPTION_ARG_INT, &app->detect_batch,
+        "Run the face detection model on N frames per invoke in batch mode", "N" },
+    { NULL }
+  };
+
+  context = g_option_context_new ("- face mesh pipeline");
+  g_option_context_add_main_entries (context, entries, NULL);
+  /* GStreamer options are handled by gst_init() */
+  g_option_context_set_ignore_unknown_options (context, TRUE);
+
+  ret = g_option_context_parse (context, argc, argv, &err);
+  if (!ret) {
+    g_printerr ("Failed to parse options: %s\n", err->message);
+    g_clear_error (&err);
+  }
+
+  g_option_context_free (context);
+  return ret;
+}
+
 int
 main (int argc, char *argv[])
 {
-  AppData app;
+  AppData app = { 0 };
   GstBus *bus;
 
+  app.start_time = g_get_monotonic_time ();
+
+  if (!parse_options (&app, &argc, &argv)) {
+    return -1;
+  }
+
+  if (app.minimal_registry) {
+    /* reuse the registry cache as is, and never fork a scanner process */
+    g_setenv ("GST_REGISTRY_UPDATE", "no", TRUE);
+    gst_registry_fork_set_enabled (FALSE);
+  }
+
   /* Initialize GStreamer */
   gst_init (&argc, &argv);
+  _print_log ("gst_init: %.1f ms", (g_get_monotonic_time () - app.start_time) / 1000.0);
+
+#ifdef CROPSCALE_STATIC
+  if (!GST_ELEMENT_REGISTER (crop_scale, NULL)) {
+    g_printerr ("crop_scale could not be registered.\n");
+    return -1;
+  }
+#endif
+
+  if (app.batch_inputs) {
+    int ret = run_batch (&app);
+
+    free_options (&app);
+    return ret;
+  }
 
   /* Build the pipeline */
   if (!init_app (&app)) {
@@ -622,14 +4211,23 @@ main (int argc, char *argv[])
   gst_bus_add_signal_watch (bus);
   g_signal_connect (G_OBJECT (bus), "message", (GCallback) message_cb, &app);
 
+  /* kill -HUP reloads both models from their files without stopping the camera */
+  app.model_swap_id = g_unix_signal_add (SIGHUP, model_swap_signal_cb, &app);
+
   /* Start pipeline */
-  gst_element_set_state (app.pipeline, GST_STATE_PLAYING);
+  app_start_pipeline (&app);
   g_main_loop_run (app.loop);
 
+  print_queue_stats (&app);
+  _print_log ("flexible_tensor_scale plan rebuilds: %" G_GUINT64_FORMAT, app.flexible_plan.rebuilds);
+  if (app.landmark_interval > 1) {
+    g_print ("landmark frames: %" G_GUINT64_FORMAT " inferred, %" G_GUINT64_FORMAT " extrapolated\n",
+        app.landmark_inferred, app.landmark_extrapolated);
+  }
+
   /* Free resources */
   gst_object_unref (bus);
-  gst_element_set_state (app.pipeline, GST_STATE_NULL);
-  gst_object_unref (app.pipeline);
-  g_main_loop_unref (app.loop);
+  free_app (&app);
+  free_options (&app);
   return 0;
 }
@@ -0,0 +1,300 @@
+#include <gst/gst.h>
+#include <sched.h>
+#include <stdio.h>
+
+/**
+ * @brief Inference options of a tflite tensor_filter.
+ */
+typedef struct
+{
+  gint num_threads; /**< interpreter threads, 0 for the framework default */
+  gboolean xnnpack; /**< use the XNNPACK delegate */
+} InferenceOptions;
+
+/**
+ * @brief Get the tensor_filter custom property for the inference options.
+ * @return newly allocated string, NULL if the framework defaults apply.
+ */
+static gchar *
+inference_options_to_custom (const InferenceOptions *options)
+{
+  GString *custom;
+
+  if (options->num_threads <= 0 && !options->xnnpack)
+    return NULL;
+
+  custom = g_string_new (NULL);
+  if (options->num_threads > 0)
+    g_string_append_printf (custom, "NumThreads:%d", options->num_threads);
+  if (options->xnnpack)
+    g_string_append_printf (custom, "%sDelegate:XNNPACK", custom->len ? "," : "");
+
+  return g_string_free (custom, FALSE);
+}
+
+/**
+ * @brief Read the CPU limit of the cgroup, in number of CPUs rounded up.
+ * @return 0 if the cgroup has no CPU quota.
+ */
+static guint
+model_bench_cgroup_cpus (void)
+{
+  gchar *contents = NULL;
+  gint64 quota = -1, period = 0;
+
+  /* cgroup v2: "<quota> <period>" or "max <period>" */
+  if (g_file_get_contents ("/sys/fs/cgroup/cpu.max", &contents, NULL, NULL)) {
+    gchar **fields = g_strsplit (g_strstrip (contents), " ", 2);
+
+    if (g_strv_length (fields) == 2 && g_strcmp0 (fields[0], "max") != 0) {
+      quota = g_ascii_strtoll (fields[0], NULL, 10);
+      period = g_ascii_strtoll (fields[1], NULL, 10);
+    }
+    g_strfreev (fields);
+    g_free (contents);
+  } else if (g_file_get_contents ("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", &contents, NULL, NULL)) {
+    /* cgroup v1 */
+    quota = g_ascii_strtoll (contents, NULL, 10);
+    g_free (contents);
+
+    if (g_file_get_contents ("/sys/fs/cgroup/cpu/cpu.cfs_period_us", &contents, NULL, NULL)) {
+      period = g_ascii_strtoll (contents, NULL, 10);
+      g_free (contents);
+    }
+  }
+
+  if (quota <= 0 || period <= 0)
+    return 0;
+
+  return (guint) ((quota + period - 1) / period);
+}
+
+/**
+ * @brief Get the number of CPUs this process may use, respecting affinity and cgroup quota.
+ */
+static guint
+model_bench_cpu_budget (void)
+{
+  cpu_set_t set;
+  guint cpus, quota_cpus;
+
+  CPU_ZERO (&set);
+  if (sched_getaffinity (0, sizeof (set), &set) == 0)
+    cpus = CPU_COUNT (&set);
+  else
+    cpus = g_get_num_processors ();
+
+  quota_cpus = model_bench_cgroup_cpus ();
+  if (quota_cpus > 0)
+    cpus = MIN (cpus, quota_cpus);
+
+  return MAX (cpus, 1);
+}
+
+/**
+ * @brief Frame counter of a benchmark run.
+ */
+typedef struct
+{
+  guint skip; /**< warm-up frames excluded from the timing */
+  guint count;
+  gint64 start_us;
+  gint64 end_us;
+} ModelBenchCount;
+
+static GstPadProbeReturn
+model_bench_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  ModelBenchCount *c = user_data;
+  gint64 now = g_get_monotonic_time ();
+
+  if (c->count == c->skip)
+    c->start_us = now;
+  c->count++;
+  c->end_us = now;
+
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Run a tflite model on synthetic frames.
+ * @param model_path tflite model file
+ * @param width width of the model input
+ * @param height height of the model input
+ * @param transform_option tensor_transform arithmetic option, NULL to feed uint8 pixels
+ * @param custom tensor_filter custom property, may be NULL
+ * @param shared_key shared-tensor-filter-key of the filter, may be NULL
+ * @param num_warmup frames excluded from the timing
+ * @param num_frames timed frames
+ * @param[out] avg_ms average time per timed frame, may be NULL
+ * @param[out] keep if not NULL, receives the pipeline which is left running
+ *             so that a shared interpreter stays loaded
+ * @return TRUE if all the frames went through the model.
+ */
+static gboolean
+model_bench_run (const gchar *model_path, guint width, guint height,
+    const gchar *transform_option, const gchar *custom, const gchar *shared_key,
+    guint num_warmup, guint num_frames, gdouble *avg_ms, GstElement **keep)
+{
+  GstElement *pipeline, *sink;
+  GstPad *pad;
+  GstBus *bus;
+  GstMessage *msg;
+  GError *err = NULL;
+  ModelBenchCount count = { .skip = num_warmup };
+  gchar *transform, *shared, *desc;
+  gboolean ret = FALSE;
+
+  transform = transform_option ?
+      g_strdup_printf ("! tensor_transform mode=arithmetic option=%s", transform_option) :
+      g_strdup ("");
+  shared = shared_key ?
+      g_strdup_printf ("shared-tensor-filter-key=%s", shared_key) : g_strdup ("");
+  desc = g_strdup_printf ("videotestsrc num-buffers=%u pattern=black "
+      "! video/x-raw,format=RGB,width=%u,height=%u,framerate=30/1 "
+      "! tensor_converter %s "
+      "! tensor_filter framework=tensorflow-lite model=\"%s\" custom=\"%s\" %s "
+      "! fakesink name=sink sync=false",
+      num_warmup + num_frames, width, height, transform, model_path,
+      custom ? custom : "", shared);
+
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  g_free (shared);
+  g_free (transform);
+  if (!pipeline || err) {
+    g_printerr ("benchmark pipeline could not be created: %s\n", err ? err->message : "unknown");
+    g_clear_error (&err);
+    if (pipeline)
+      gst_object_unref (pipeline);
+    return FALSE;
+  }
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, model_bench_probe_cb, &count, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, 60 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (msg && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS
+      && count.count == num_warmup + num_frames) {
+    ret = TRUE;
+    if (avg_ms && num_frames > 1) {
+      /* timing starts when the first timed frame arrives */
+      *avg_ms = (count.end_us - count.start_us) / 1000.0 / (num_frames - 1);
+    }
+  }
+
+  if (msg)
+    gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  if (keep && ret) {
+    *keep = pipeline;
+  } else {
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    gst_object_unref (pipeline);
+  }
+
+  return ret;
+}
+
+/**
+ * @brief Benchmark a few inference options and keep the fastest.
+ * @param max_threads upper bound of the interpreter threads
+ * @param[in/out] best the options to start from, replaced by the fastest one
+ */
+static void
+model_bench_tune (const gchar *name, const gchar *model_path, guint width, guint height,
+    const gchar *transform_option, guint max_threads, InferenceOptions *best)
+{
+  InferenceOptions candidate;
+  gdouble best_ms = G_MAXDOUBLE;
+  gint threads;
+
+  for (threads = 1; threads <= (gint) max_threads; threads *= 2) {
+    for (gint xnnpack = 0; xnnpack <= 1; xnnpack++) {
+      gchar *custom;
+      gdouble avg_ms;
+      gboolean ok;
+
+      candidate.num_threads = threads;
+      candidate.xnnpack = xnnpack;
+      custom = inference_options_to_custom (&candidate);
+      ok = model_bench_run (model_path, width, height, transform_option, custom, NULL,
+          3, 20, &avg_ms, NULL);
+
+      if (ok) {
+        g_print ("[autotune] %s: threads %d, xnnpack %s: %.2f ms\n",
+            name, threads, xnnpack ? "on" : "off", avg_ms);
+        if (avg_ms < best_ms) {
+          best_ms = avg_ms;
+          *best = candidate;
+        }
+      } else {
+        g_print ("[autotune] %s: threads %d, xnnpack %s: failed\n",
+            name, threads, xnnpack ? "on" : "off");
+      }
+      g_free (custom);
+    }
+  }
+
+  if (best_ms < G_MAXDOUBLE) {
+    g_print ("[autotune] %s: using threads %d, xnnpack %s\n",
+        name, best->num_threads, best->xnnpack ? "on" : "off");
+  }
+}
+
+/**
+ * @brief Warm-up of a model before the camera starts.
+ */
+typedef struct
+{
+  const gchar *name;
+  const gchar *model_path;
+  guint width;
+  guint height;
+  const gchar *transform_option;
+  gchar *custom;
+  const gchar *shared_key; /**< key shared with the tensor_filter of the app pipeline */
+
+  GstElement *pipeline; /**< holds the warmed-up interpreter until the app pipeline runs */
+  gboolean ok;
+  gint64 elapsed_us;
+} ModelWarmup;
+
+/**
+ * @brief Thread function that loads a model and runs warm-up inferences on dummy frames.
+ */
+static gpointer
+model_warmup_thread (gpointer data)
+{
+  ModelWarmup *warmup = data;
+  gint64 start = g_get_monotonic_time ();
+
+  warmup->ok = model_bench_run (warmup->model_path, warmup->width, warmup->height,
+      warmup->transform_option, warmup->custom, warmup->shared_key,
+      3, 0, NULL, &warmup->pipeline);
+  warmup->elapsed_us = g_get_monotonic_time () - start;
+
+  return NULL;
+}
+
+/**
+ * @brief Release the warm-up pipeline. The shared interpreter stays with the app pipeline.
+ */
+static void
+model_warmup_release (ModelWarmup *warmup)
+{
+  if (warmup->pipeline) {
+    gst_element_set_state (warmup->pipeline, GST_STATE_NULL);
+    gst_object_unref (warmup->pipeline);
+    warmup->pipeline = NULL;
+  }
+
+  g_clear_pointer (&warmup->custom, g_free);
+}
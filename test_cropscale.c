@@ -0,0 +1,372 @@
+/**
+ * @file test_cropscale.c
+ * @brief Correctness check and benchmark of the crop_scale element.
+ *
+ * crop_scale is driven through GstHarness with synthetic RGBA frames and
+ * crop info flexible tensors. Every frame pixel encodes its own position,
+ * so the output tells which source pixel was picked and is compared with
+ * an integer reference scaler. The element computes the source index with
+ * float math, which may round one pixel below the exact index, so a one
+ * pixel difference is counted but accepted.
+ *
+ * ./test_cropscale           checks all the cases, exit status 1 on failure
+ * ./test_cropscale --bench   also reports frames/s of the element and ns/pixel
+ *                            of gst_crop_scale_do_scale for each case
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <gst/check/gstharness.h>
+
+/* the element is built into the test so that do_scale can be timed alone */
+#include "gstcropscale.c"
+
+/**
+ * @brief Crop region given to crop_scale, in frame pixels.
+ */
+typedef struct
+{
+  guint x;
+  guint y;
+  guint w;
+  guint h;
+} TestRoi;
+
+/**
+ * @brief A test case, a frame size and a crop region in it.
+ */
+typedef struct
+{
+  const gchar *name;
+  guint width;
+  guint height;
+  TestRoi roi;
+} TestCase;
+
+static const TestCase test_cases[] = {
+  { "vga full", 640, 480, { 0, 0, 640, 480 } },
+  { "vga 1x1", 640, 480, { 10, 20, 1, 1 } },
+  { "vga 16x16 origin", 640, 480, { 0, 0, 16, 16 } },
+  { "vga 192x192 center", 640, 480, { 224, 144, 192, 192 } },
+  { "vga 97x131 odd", 640, 480, { 301, 77, 97, 131 } },
+  { "vga right edge", 640, 480, { 600, 100, 128, 128 } },
+  { "vga bottom edge", 640, 480, { 100, 400, 128, 128 } },
+  { "vga corner out", 640, 480, { 639, 479, 64, 64 } },
+  { "vga outside", 640, 480, { 640, 480, 32, 32 } },
+  { "vga larger than frame", 640, 480, { 0, 0, 800, 600 } },
+  { "odd 333x197 wide", 333, 197, { 5, 50, 320, 40 } },
+  { "odd 333x197 tall", 333, 197, { 200, 3, 17, 190 } },
+  { "hd 256x256", 1280, 720, { 512, 232, 256, 256 } },
+  { "hd full", 1280, 720, { 0, 0, 1280, 720 } },
+  { "fhd 192x192", 1920, 1080, { 864, 444, 192, 192 } },
+  { "fhd 720x720", 1920, 1080, { 600, 180, 720, 720 } },
+};
+
+/**
+ * @brief Test options.
+ */
+static gboolean opt_bench = FALSE;
+static gint opt_frames = 0;
+
+/**
+ * @brief Pixel of the synthetic frame, its position packed in RGBA.
+ */
+static inline guint32
+test_pixel (guint x, guint y)
+{
+  guint8 p[4];
+  guint32 v;
+
+  p[0] = x & 0xff;
+  p[1] = y & 0xff;
+  p[2] = ((x >> 8) & 0xf) | ((y >> 8) & 0xf) << 4;
+  p[3] = 0xff;
+  memcpy (&v, p, 4);
+  return v;
+}
+
+/**
+ * @brief Get the source position from a pixel of the synthetic frame.
+ */
+static inline void
+test_pixel_position (const guint8 * p, guint * x, guint * y)
+{
+  *x = p[0] | (p[2] & 0xf) << 8;
+  *y = p[1] | (p[2] >> 4) << 8;
+}
+
+static GstBuffer *
+test_make_frame (guint width, guint height)
+{
+  GstBuffer *buffer = gst_buffer_new_allocate (NULL, 4 * width * height, NULL);
+  GstMapInfo map;
+  guint32 *out;
+  guint x, y;
+
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  out = (guint32 *) map.data;
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      *out++ = test_pixel (x, y);
+  gst_buffer_unmap (buffer, &map);
+
+  return buffer;
+}
+
+/**
+ * @brief Make the crop info as a flexible tensor, uint32 x, y, w, h.
+ */
+static GstBuffer *
+test_make_crop_info (const TestRoi * roi)
+{
+  GstTensorMetaInfo meta;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  gsize hsize;
+  guint32 *pos;
+
+  gst_tensor_meta_info_init (&meta);
+  meta.type = _NNS_UINT32;
+  meta.dimension[0] = 4;
+  meta.dimension[1] = 1;
+  meta.dimension[2] = 1;
+  meta.dimension[3] = 1;
+  meta.format = _NNS_TENSOR_FORMAT_FLEXIBLE;
+  hsize = gst_tensor_meta_info_get_header_size (&meta);
+
+  buffer = gst_buffer_new_allocate (NULL, hsize + 4 * sizeof (guint32), NULL);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  gst_tensor_meta_info_update_header (&meta, map.data);
+  pos = (guint32 *) (map.data + hsize);
+  pos[0] = roi->x;
+  pos[1] = roi->y;
+  pos[2] = roi->w;
+  pos[3] = roi->h;
+  gst_buffer_unmap (buffer, &map);
+
+  return buffer;
+}
+
+/**
+ * @brief Mismatch counters of a case.
+ */
+typedef struct
+{
+  guint64 pixels;
+  guint64 rounded; /**< pixels one source pixel away from the reference */
+  guint64 wrong;
+} TestErrors;
+
+/**
+ * @brief Compare an output frame with the reference scaler.
+ *
+ * The whole frame is scaled into the crop region, which is clipped to the
+ * frame, and everything else is zero.
+ */
+static void
+test_check_frame (const TestCase * tc, GstBuffer * output, TestErrors * errors)
+{
+  const TestRoi *roi = &tc->roi;
+  GstMapInfo map;
+  guint x, y;
+
+  gst_buffer_map (output, &map, GST_MAP_READ);
+  g_assert_cmpuint (map.size, ==, 4 * tc->width * tc->height);
+
+  for (y = 0; y < tc->height; y++) {
+    for (x = 0; x < tc->width; x++) {
+      const guint8 *p = map.data + 4 * (tc->width * y + x);
+      gboolean inside = x >= roi->x && x - roi->x < roi->w
+          && y >= roi->y && y - roi->y < roi->h;
+      guint ref_x, ref_y, sx, sy;
+
+      errors->pixels++;
+
+      if (!inside) {
+        if (p[0] || p[1] || p[2] || p[3])
+          errors->wrong++;
+        continue;
+      }
+
+      if (p[3] != 0xff) {
+        errors->wrong++;
+        continue;
+      }
+
+      ref_x = (guint64) (x - roi->x) * tc->width / roi->w;
+      ref_y = (guint64) (y - roi->y) * tc->height / roi->h;
+      test_pixel_position (p, &sx, &sy);
+
+      if (sx == ref_x && sy == ref_y)
+        continue;
+      if (ABS ((gint) sx - (gint) ref_x) <= 1 && ABS ((gint) sy - (gint) ref_y) <= 1)
+        errors->rounded++;
+      else
+        errors->wrong++;
+    }
+  }
+
+  gst_buffer_unmap (output, &map);
+}
+
+/**
+ * @brief Feeder of the info pad.
+ *
+ * collectpads blocks a push until the buffers of all pads were collected,
+ * so the info buffers are pushed from their own thread.
+ */
+typedef struct
+{
+  GstHarness *harness;
+  GstBuffer *info;
+  guint count;
+} TestFeeder;
+
+static gpointer
+test_feeder_thread (gpointer user_data)
+{
+  TestFeeder *feeder = user_data;
+  guint i;
+
+  for (i = 0; i < feeder->count; i++) {
+    if (gst_harness_push (feeder->harness, gst_buffer_ref (feeder->info)) != GST_FLOW_OK)
+      break;
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Run a case through the element.
+ * @return TRUE if every output frame matches the reference.
+ */
+static gboolean
+test_run_case (const TestCase * tc, guint frames)
+{
+  GstHarness *h_raw, *h_info;
+  GstBuffer *frame;
+  TestFeeder feeder;
+  TestErrors errors = { 0 };
+  GThread *thread;
+  gchar *caps;
+  gint64 start, elapsed;
+  guint i;
+  gboolean ok;
+
+  h_raw = gst_harness_new_with_padnames ("crop_scale", "raw", "src");
+  h_info = gst_harness_new_with_element (h_raw->element, "info", NULL);
+
+  caps = g_strdup_printf ("video/x-raw,format=RGBA,width=%u,height=%u,framerate=30/1",
+      tc->width, tc->height);
+  gst_harness_set_src_caps_str (h_raw, caps);
+  g_free (caps);
+  gst_harness_set_src_caps_str (h_info, "other/tensors,format=flexible,framerate=30/1");
+
+  frame = test_make_frame (tc->width, tc->height);
+  feeder.harness = h_info;
+  feeder.info = test_make_crop_info (&tc->roi);
+  feeder.count = frames;
+  thread = g_thread_new ("info-feeder", test_feeder_thread, &feeder);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < frames; i++) {
+    GstBuffer *output;
+
+    GST_BUFFER_PTS (frame) = i * GST_SECOND / 30;
+    g_assert_cmpint (gst_harness_push (h_raw, gst_buffer_ref (frame)), ==, GST_FLOW_OK);
+
+    output = gst_harness_pull (h_raw);
+    g_assert (output != NULL);
+    /* check the first frame, and every frame out of the bench */
+    if (i == 0 || !opt_bench)
+      test_check_frame (tc, output, &errors);
+    gst_buffer_unref (output);
+  }
+  elapsed = g_get_monotonic_time () - start;
+  g_thread_join (thread);
+
+  ok = (errors.wrong == 0);
+  g_print ("%-24s %4ux%-4u roi %4u,%-4u %4ux%-4u %s", tc->name, tc->width, tc->height,
+      tc->roi.x, tc->roi.y, tc->roi.w, tc->roi.h, ok ? "ok" : "FAIL");
+  if (errors.rounded || errors.wrong)
+    g_print (" (%" G_GUINT64_FORMAT " rounded, %" G_GUINT64_FORMAT " wrong of %"
+        G_GUINT64_FORMAT ")", errors.rounded, errors.wrong, errors.pixels);
+
+  if (opt_bench) {
+    GstCropScale *self = GST_CROP_SCALE (h_raw->element);
+    GstVideoInfo vinfo;
+    tensor_crop_info_s cinfo;
+    gint64 scale_start, scale_elapsed;
+    guint crop_w = MIN (tc->roi.w, tc->width - MIN (tc->roi.x, tc->width));
+    guint crop_h = MIN (tc->roi.h, tc->height - MIN (tc->roi.y, tc->height));
+    gdouble roi_pixels = MAX ((gdouble) crop_w * crop_h, 1);
+
+    gst_video_info_set_format (&vinfo, GST_VIDEO_FORMAT_RGBA, tc->width, tc->height);
+
+    scale_start = g_get_monotonic_time ();
+    for (i = 0; i < frames; i++) {
+      GstBuffer *output;
+
+      /* do_scale clips the region in place */
+      cinfo = (tensor_crop_info_s) { tc->roi.x, tc->roi.y, tc->roi.w, tc->roi.h, 0.0f };
+      output = gst_crop_scale_do_scale (self, frame, &vinfo, &cinfo);
+      gst_buffer_unref (output);
+    }
+    scale_elapsed = MAX (g_get_monotonic_time () - scale_start, 1);
+
+    g_print ("  %8.1f frames/s  do_scale %8.1f us %6.3f ns/px %6.3f ns/roi px",
+        frames * 1e6 / MAX (elapsed, 1), (gdouble) scale_elapsed / frames,
+        scale_elapsed * 1e3 / frames / (tc->width * tc->height),
+        scale_elapsed * 1e3 / frames / roi_pixels);
+  }
+  g_print ("\n");
+
+  gst_buffer_unref (feeder.info);
+  gst_buffer_unref (frame);
+  gst_harness_teardown (h_info);
+  gst_harness_teardown (h_raw);
+
+  return ok;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionEntry entries[] = {
+    { "bench", 0, 0, G_OPTION_ARG_NONE, &opt_bench,
+        "Report frames/s and ns/pixel for each case", NULL },
+    { "frames", 0, 0, G_OPTION_ARG_INT, &opt_frames,
+        "Frames per case, default 3 or 300 with --bench", "N" },
+    { NULL }
+  };
+  GOptionContext *context;
+  GError *err = NULL;
+  guint i, failed = 0;
+
+  context = g_option_context_new ("- crop_scale check and benchmark");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &err)) {
+    g_printerr ("Failed to parse options: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (context);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (opt_frames <= 0)
+    opt_frames = opt_bench ? 300 : 3;
+
+  gst_init (&argc, &argv);
+  if (!GST_ELEMENT_REGISTER (crop_scale, NULL)) {
+    g_printerr ("crop_scale could not be registered.\n");
+    return 1;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (test_cases); i++) {
+    if (!test_run_case (&test_cases[i], opt_frames))
+      failed++;
+  }
+
+  g_print ("%u of %u cases failed\n", failed, (guint) G_N_ELEMENTS (test_cases));
+  return failed ? 1 : 0;
+}